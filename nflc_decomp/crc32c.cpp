@@ -0,0 +1,123 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC32C_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+#if defined(CRC32C_X86)
+// SSE4.2 kernel, built in its own translation unit (crc32c_sse42.cpp)
+uint32_t crc32cUpdateSse42(uint32_t crc, const unsigned char* p, size_t len);
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78;   // 0x1EDC6F41, bit-reversed
+
+// TABLES[k][b] is the CRC of byte b followed by k zero bytes
+constexpr std::array<std::array<uint32_t, 256>, 8> makeTables() {
+    std::array<std::array<uint32_t, 256>, 8> t{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+        }
+        t[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (size_t k = 1; k < 8; k++) {
+            t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+        }
+    }
+    return t;
+}
+
+constexpr auto TABLES = makeTables();
+
+// Slicing-by-8 on the running (inverted) CRC; assumes a little-endian host like the rest of the tool
+uint32_t crc32cUpdateTable(uint32_t crc, const unsigned char* p, size_t len) {
+    while (len >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = TABLES[7][lo & 0xFF] ^ TABLES[6][(lo >> 8) & 0xFF] ^ TABLES[5][(lo >> 16) & 0xFF] ^ TABLES[4][lo >> 24] ^
+            TABLES[3][hi & 0xFF] ^ TABLES[2][(hi >> 8) & 0xFF] ^ TABLES[1][(hi >> 16) & 0xFF] ^ TABLES[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(CRC32C_ARM)
+uint32_t crc32cUpdateArm(uint32_t crc, const unsigned char* p, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+#if defined(CRC32C_X86)
+bool cpuHasSse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+using UpdateFn = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+struct Kernel {
+    UpdateFn update;
+    const char* name;
+};
+
+Kernel selectKernel() {
+#if defined(CRC32C_X86)
+    if (cpuHasSse42()) {
+        return { crc32cUpdateSse42, "sse4.2" };
+    }
+#elif defined(CRC32C_ARM)
+    return { crc32cUpdateArm, "armv8" };
+#endif
+    return { crc32cUpdateTable, "table" };
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+    return ~kernel().update(~crc, static_cast<const unsigned char*>(data), len);
+}
+
+const char* crc32cKernel() {
+    return kernel().name;
+}
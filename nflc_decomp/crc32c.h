@@ -0,0 +1,15 @@
+// CRC-32C (Castagnoli), the block checksum written by this tool
+//
+// Computed with the CPU's CRC32 instruction where there is one (SSE4.2 on x86, the ARMv8
+// CRC extension on ARM) and with slicing-by-8 tables otherwise. The implementation is
+// chosen once at runtime; all of them give the same result.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C of data[0, len). Pass a previous result as crc to continue a running checksum.
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+// Name of the implementation picked for this CPU ("sse4.2", "armv8" or "table")
+const char* crc32cKernel();
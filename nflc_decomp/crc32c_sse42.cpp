@@ -0,0 +1,46 @@
+// SSE4.2 CRC-32C kernel for crc32c.cpp, only called once the CPU is known to support SSE4.2.
+// As in lzo1x_fast_avx2.cpp, the instruction set is enabled for this file alone.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("sse4.2")
+#endif
+
+#include <nmmintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Update the running (inverted) CRC with p[0, len)
+uint32_t crc32cUpdateSse42(uint32_t crc, const unsigned char* p, size_t len) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+#include "lzo1x_fast.h"
+#include "lzo1x_fast_impl.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LZO1X_FAST_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LZO1X_FAST_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LZO1X_FAST_NEON 1
+#endif
+
+#if defined(LZO1X_FAST_X86)
+// AVX2 kernels, built in their own translation unit (lzo1x_fast_avx2.cpp)
+int lzo1xDecompressAvx2(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen);
+int lzo1xDecompressAvx2Unchecked(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen);
+#endif
+
+namespace {
+
+struct CopyScalar {
+    static constexpr size_t WIDTH = 8;
+    static void copy(unsigned char* dst, const unsigned char* src) { std::memcpy(dst, src, WIDTH); }
+};
+
+#if defined(LZO1X_FAST_SSE2)
+struct CopySse2 {
+    static constexpr size_t WIDTH = 16;
+    static void copy(unsigned char* dst, const unsigned char* src) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    }
+};
+#elif defined(LZO1X_FAST_NEON)
+struct CopyNeon {
+    static constexpr size_t WIDTH = 16;
+    static void copy(unsigned char* dst, const unsigned char* src) { vst1q_u8(dst, vld1q_u8(src)); }
+};
+#endif
+
+#if defined(LZO1X_FAST_X86)
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using DecodeFn = int (*)(const unsigned char*, size_t, unsigned char*, size_t&);
+
+struct Kernel {
+    DecodeFn decode;
+    DecodeFn decodeUnchecked;
+    const char* name;
+};
+
+Kernel selectKernel() {
+#if defined(LZO1X_FAST_X86)
+    if (cpuHasAvx2()) {
+        return { lzo1xDecompressAvx2, lzo1xDecompressAvx2Unchecked, "avx2" };
+    }
+#endif
+#if defined(LZO1X_FAST_SSE2)
+    return { decodeLzo1x<CopySse2>, decodeLzo1x<CopySse2, false>, "sse2" };
+#elif defined(LZO1X_FAST_NEON)
+    return { decodeLzo1x<CopyNeon>, decodeLzo1x<CopyNeon, false>, "neon" };
+#else
+    return { decodeLzo1x<CopyScalar>, decodeLzo1x<CopyScalar, false>, "scalar" };
+#endif
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+int lzo1xDecompressFast(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen) {
+    return kernel().decode(src, srcLen, dst, dstLen);
+}
+
+int lzo1xDecompressFastUnchecked(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen) {
+    return kernel().decodeUnchecked(src, srcLen, dst, dstLen);
+}
+
+const char* lzo1xFastKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,24 @@
+// Wide-copy LZO1X decoder
+//
+// A drop-in replacement for lzo1x_decompress_safe on the decompression hot path: same bounds
+// checks, same result codes and output length for any input, but literal runs and
+// non-overlapping matches are copied with the widest vectors the CPU offers (AVX2 or SSE2
+// on x86, NEON on ARM, 8-byte words otherwise). The kernel is chosen once at runtime.
+//
+// Unlike lzo1x_decompress_safe it may scribble over the bytes between the end of the
+// decoded data and dst + dstLen; nothing at or past dst + dstLen is ever touched.
+#pragma once
+
+#include <cstddef>
+
+// Decode src[0, srcLen) into dst, which holds dstLen bytes. On return dstLen is the number
+// of bytes produced. Returns LZO_E_OK or the error lzo1x_decompress_safe would report.
+int lzo1xDecompressFast(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen);
+
+// The same decoder with the bounds checks compiled out, like miniLZO's lzo1x_decompress.
+// Only for streams already known to decode cleanly into dstLen bytes; anything else is
+// undefined behaviour.
+int lzo1xDecompressFastUnchecked(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen);
+
+// Name of the kernel picked for this CPU ("avx2", "sse2", "neon" or "scalar")
+const char* lzo1xFastKernel();
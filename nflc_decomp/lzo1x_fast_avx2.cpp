@@ -0,0 +1,39 @@
+// AVX2 kernel for lzo1x_fast.cpp, only called once the CPU is known to support AVX2.
+// The instruction set is enabled for this file alone; it includes nothing but C headers
+// and the internal-linkage decoder, so no AVX2 code can leak into shared inline functions.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+
+#include "lzo1x_fast_impl.h"
+
+namespace {
+
+struct CopyAvx2 {
+    static constexpr size_t WIDTH = 32;
+    static void copy(unsigned char* dst, const unsigned char* src) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+    }
+};
+
+} // namespace
+
+int lzo1xDecompressAvx2(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen) {
+    return decodeLzo1x<CopyAvx2>(src, srcLen, dst, dstLen);
+}
+
+int lzo1xDecompressAvx2Unchecked(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen) {
+    return decodeLzo1x<CopyAvx2, false>(src, srcLen, dst, dstLen);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
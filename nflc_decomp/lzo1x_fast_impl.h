@@ -0,0 +1,246 @@
+// LZO1X decoder body shared by the lzo1x_fast kernels (internal to lzo1x_fast*.cpp)
+//
+// This is lzo1x_decompress_safe from minilzo.c with the same checks in the same order, so
+// it returns the same result and output length for any input. Only the copy loops differ:
+// literal runs and matches at least Wide::WIDTH bytes back are moved in whole vectors,
+// which may write up to WIDTH - 1 bytes past the copy (never past the end of the output
+// buffer). Copies of up to 8 bytes, the common case, are a single 8-byte move, and nearer
+// overlapping matches fall back to 8-byte or byte copies. With Checked = false the input,
+// output and lookbehind checks are compiled out, for streams already known to decode cleanly.
+//
+// Every kernel translation unit includes this after selecting its instruction set, and
+// everything here has internal linkage so no out-of-line copy is shared between them.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "minilzo.h"
+}
+
+namespace {
+
+template <class Wide>
+inline void copyLiteralsWide(unsigned char*& op, const unsigned char*& ip, size_t n, size_t opRoom, size_t ipRoom) {
+    if (n <= 8 && opRoom >= 8 && ipRoom >= 8) {
+        std::memcpy(op, ip, 8);
+    }
+    else if (opRoom >= n + Wide::WIDTH && ipRoom >= n + Wide::WIDTH) {
+        size_t k = 0;
+        do {
+            Wide::copy(op + k, ip + k);
+            k += Wide::WIDTH;
+        } while (k < n);
+    }
+    else {
+        std::memcpy(op, ip, n);
+    }
+    op += n;
+    ip += n;
+}
+
+template <class Wide>
+inline void copyMatchWide(unsigned char*& op, size_t dist, size_t n, size_t opRoom) {
+    const unsigned char* m = op - dist;
+    if (n <= 8 && dist >= 8 && opRoom >= 8) {
+        std::memcpy(op, m, 8);
+    }
+    else if (dist >= Wide::WIDTH && opRoom >= n + Wide::WIDTH) {
+        size_t k = 0;
+        do {
+            Wide::copy(op + k, m + k);
+            k += Wide::WIDTH;
+        } while (k < n);
+    }
+    else if (dist >= 8 && opRoom >= n + 8) {
+        size_t k = 0;
+        do {
+            std::memcpy(op + k, m + k, 8);
+            k += 8;
+        } while (k < n);
+    }
+    else if (dist == 1) {
+        std::memset(op, *m, n);
+    }
+    else {
+        for (size_t k = 0; k < n; k++) {
+            op[k] = m[k];
+        }
+    }
+    op += n;
+}
+
+template <class Wide, bool Checked = true>
+int decodeLzo1x(const unsigned char* in, size_t inLen, unsigned char* out, size_t& outLen) {
+    const unsigned char* ip = in;
+    const unsigned char* const ipEnd = in + inLen;
+    unsigned char* op = out;
+    unsigned char* const opEnd = out + outLen;
+    size_t t;
+    size_t dist;
+    outLen = 0;
+
+#define NEED_IP(x) if (Checked && static_cast<size_t>(ipEnd - ip) < static_cast<size_t>(x)) goto input_overrun
+#define NEED_OP(x) if (Checked && static_cast<size_t>(opEnd - op) < static_cast<size_t>(x)) goto output_overrun
+#define TEST_IV(x) if (Checked && (x) > SIZE_MAX - 510) goto input_overrun
+#define TEST_OV(x) if (Checked && (x) > SIZE_MAX - 510) goto output_overrun
+#define TEST_LB(d) if (Checked && (d) > static_cast<size_t>(op - out)) goto lookbehind_overrun
+#define OP_ROOM static_cast<size_t>(opEnd - op)
+#define IP_ROOM static_cast<size_t>(ipEnd - ip)
+
+    NEED_IP(1);
+    if (*ip > 17) {
+        t = *ip++ - 17;
+        if (t < 4) {
+            goto match_next;
+        }
+        NEED_OP(t);
+        NEED_IP(t + 3);
+        copyLiteralsWide<Wide>(op, ip, t, OP_ROOM, IP_ROOM);
+        goto first_literal_run;
+    }
+
+    for (;;) {
+        NEED_IP(3);
+        t = *ip++;
+        if (t >= 16) {
+            goto match;
+        }
+        // Literal run
+        if (t == 0) {
+            while (*ip == 0) {
+                t += 255;
+                ip++;
+                TEST_IV(t);
+                NEED_IP(1);
+            }
+            t += 15 + *ip++;
+        }
+        NEED_OP(t + 3);
+        NEED_IP(t + 6);
+        copyLiteralsWide<Wide>(op, ip, t + 3, OP_ROOM, IP_ROOM);
+
+    first_literal_run:
+        t = *ip++;
+        if (t >= 16) {
+            goto match;
+        }
+        // Three-byte match just beyond the M2 range, only valid after a literal run
+        dist = (1 + 0x0800) + (t >> 2) + (static_cast<size_t>(*ip++) << 2);
+        TEST_LB(dist);
+        NEED_OP(3);
+        std::memcpy(op, op - dist, 3);
+        op += 3;
+        goto match_done;
+
+        for (;;) {
+        match:
+            if (t >= 64) {
+                // M2: 3..8 bytes, up to 2KB back
+                dist = 1 + ((t >> 2) & 7) + (static_cast<size_t>(*ip++) << 3);
+                t = (t >> 5) - 1;
+                TEST_LB(dist);
+                NEED_OP(t + 3 - 1);
+                goto copy_match;
+            }
+            else if (t >= 32) {
+                // M3: up to 16KB back
+                t &= 31;
+                if (t == 0) {
+                    while (*ip == 0) {
+                        t += 255;
+                        ip++;
+                        TEST_OV(t);
+                        NEED_IP(1);
+                    }
+                    t += 31 + *ip++;
+                    NEED_IP(2);
+                }
+                dist = 1 + (ip[0] >> 2) + (static_cast<size_t>(ip[1]) << 6);
+                ip += 2;
+            }
+            else if (t >= 16) {
+                // M4: 16KB..48KB back; distance zero marks the end of the stream
+                dist = static_cast<size_t>(t & 8) << 11;
+                t &= 7;
+                if (t == 0) {
+                    while (*ip == 0) {
+                        t += 255;
+                        ip++;
+                        TEST_OV(t);
+                        NEED_IP(1);
+                    }
+                    t += 7 + *ip++;
+                    NEED_IP(2);
+                }
+                dist += (ip[0] >> 2) + (static_cast<size_t>(ip[1]) << 6);
+                ip += 2;
+                if (dist == 0) {
+                    goto eof_found;
+                }
+                dist += 0x4000;
+            }
+            else {
+                // M1: two bytes, up to 1KB back, only valid after a short literal run
+                dist = 1 + (t >> 2) + (static_cast<size_t>(*ip++) << 2);
+                TEST_LB(dist);
+                NEED_OP(2);
+                op[0] = op[-static_cast<ptrdiff_t>(dist)];
+                op[1] = op[1 - static_cast<ptrdiff_t>(dist)];
+                op += 2;
+                goto match_done;
+            }
+
+            TEST_LB(dist);
+            NEED_OP(t + 3 - 1);
+        copy_match:
+            copyMatchWide<Wide>(op, dist, t + 2, OP_ROOM);
+
+        match_done:
+            // Up to three literals follow a match, counted in its last distance byte
+            t = ip[-2] & 3;
+            if (t == 0) {
+                break;
+            }
+        match_next:
+            NEED_OP(t);
+            NEED_IP(t + 3);
+            *op++ = *ip++;
+            if (t > 1) {
+                *op++ = *ip++;
+                if (t > 2) {
+                    *op++ = *ip++;
+                }
+            }
+            t = *ip++;
+        }
+    }
+
+eof_found:
+    outLen = static_cast<size_t>(op - out);
+    return ip == ipEnd ? LZO_E_OK : (ip < ipEnd ? LZO_E_INPUT_NOT_CONSUMED : LZO_E_INPUT_OVERRUN);
+
+input_overrun:
+    outLen = static_cast<size_t>(op - out);
+    return LZO_E_INPUT_OVERRUN;
+
+output_overrun:
+    outLen = static_cast<size_t>(op - out);
+    return LZO_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+    outLen = static_cast<size_t>(op - out);
+    return LZO_E_LOOKBEHIND_OVERRUN;
+
+#undef NEED_IP
+#undef NEED_OP
+#undef TEST_IV
+#undef TEST_OV
+#undef TEST_LB
+#undef OP_ROOM
+#undef IP_ROOM
+}
+
+} // namespace
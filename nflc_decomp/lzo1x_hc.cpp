@@ -0,0 +1,332 @@
+#include "lzo1x_hc.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "minilzo.h"
+}
+
+namespace {
+
+// LZO1X match classes (see lzo1x_d.ch): M2 covers short, near matches in two bytes,
+// M3 and M4 take three bytes plus length extension bytes
+constexpr uint32_t MIN_MATCH = 3;
+constexpr uint32_t M2_MAX_LEN = 8;
+constexpr uint32_t M2_MAX_OFFSET = 0x0800;
+constexpr uint32_t M3_MAX_OFFSET = 0x4000;
+constexpr uint32_t M4_MAX_OFFSET = 0xBFFF;
+constexpr uint32_t M3_MARKER = 32;
+constexpr uint32_t M4_MARKER = 16;
+
+constexpr unsigned HASH_BITS = 16;
+constexpr uint32_t INF_COST = UINT32_MAX / 2;
+
+// Prefix costs are not strictly increasing, so the parse runs this far past the budget
+// before concluding that no longer prefix fits
+constexpr uint32_t STOP_MARGIN = 256;
+
+struct LevelParams {
+    uint32_t chainDepth;    // candidates examined per position
+    uint32_t niceLen;       // a match this long is taken without parsing inside it
+};
+
+constexpr LevelParams LEVELS[] = {
+    {4, 16},        // 2
+    {8, 32},        // 3
+    {16, 48},       // 4
+    {32, 64},       // 5
+    {64, 128},      // 6
+    {128, 192},     // 7
+    {512, 256},     // 8
+    {2048, 1024},   // 9
+};
+
+inline uint32_t hash3(const unsigned char* p) {
+    uint32_t v = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Extra bytes needed to store a length of which base fits in the opcode
+inline uint32_t extensionBytes(uint32_t value, uint32_t base) {
+    return value <= base ? 0 : 1 + (value - base - 1) / 255;
+}
+
+uint32_t matchCost(uint32_t len, uint32_t dist) {
+    if (len <= M2_MAX_LEN && dist <= M2_MAX_OFFSET) {
+        return 2;
+    }
+    if (dist <= M3_MAX_OFFSET) {
+        return 3 + extensionBytes(len - 2, 31);
+    }
+    return 3 + extensionBytes(len - 2, 7);
+}
+
+// Cost of a run of count literals, atStart when nothing precedes it. Short runs after a
+// match ride in the low bits of its last byte; the stream itself starts with a 17 + n byte.
+inline uint32_t literalRunCost(uint32_t count, bool atStart) {
+    if (count == 0) {
+        return 0;
+    }
+    if (atStart && count <= 238) {
+        return count + 1;
+    }
+    if (count <= 3) {
+        return count;
+    }
+    if (count <= 18) {
+        return count + 1;
+    }
+    return count + 2 + (count - 19) / 255;
+}
+
+unsigned char* storeLength(unsigned char* op, uint32_t value) {
+    while (value > 255) {
+        value -= 255;
+        *op++ = 0;
+    }
+    *op++ = static_cast<unsigned char>(value);
+    return op;
+}
+
+unsigned char* storeLiterals(unsigned char* op, unsigned char* out, const unsigned char* lit, uint32_t count) {
+    if (count == 0) {
+        return op;
+    }
+    if (op == out && count <= 238) {
+        *op++ = static_cast<unsigned char>(17 + count);
+    }
+    else if (count <= 3) {
+        op[-2] = static_cast<unsigned char>(op[-2] | count);
+    }
+    else if (count <= 18) {
+        *op++ = static_cast<unsigned char>(count - 3);
+    }
+    else {
+        *op++ = 0;
+        op = storeLength(op, count - 18);
+    }
+    std::memcpy(op, lit, count);
+    return op + count;
+}
+
+unsigned char* storeMatch(unsigned char* op, uint32_t len, uint32_t dist) {
+    if (len <= M2_MAX_LEN && dist <= M2_MAX_OFFSET) {
+        uint32_t d = dist - 1;
+        *op++ = static_cast<unsigned char>(((len - 1) << 5) | ((d & 7) << 2));
+        *op++ = static_cast<unsigned char>(d >> 3);
+        return op;
+    }
+
+    uint32_t d;
+    if (dist <= M3_MAX_OFFSET) {
+        d = dist - 1;
+        if (len - 2 <= 31) {
+            *op++ = static_cast<unsigned char>(M3_MARKER | (len - 2));
+        }
+        else {
+            *op++ = M3_MARKER;
+            op = storeLength(op, len - 2 - 31);
+        }
+    }
+    else {
+        d = dist - 0x4000;
+        uint32_t high = (d & 0x4000) >> 11;
+        if (len - 2 <= 7) {
+            *op++ = static_cast<unsigned char>(M4_MARKER | high | (len - 2));
+        }
+        else {
+            *op++ = static_cast<unsigned char>(M4_MARKER | high);
+            op = storeLength(op, len - 2 - 7);
+        }
+    }
+    *op++ = static_cast<unsigned char>((d & 63) << 2);
+    *op++ = static_cast<unsigned char>((d & 0x3FFF) >> 6);
+    return op;
+}
+
+} // namespace
+
+int lzo1xHcCompressPrefix(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstCapacity,
+    size_t& consumed, size_t& dstLen, int level, Lzo1xHcScratch& s) {
+    consumed = 0;
+    dstLen = 0;
+    if (srcLen > INT32_MAX / 2) {
+        return LZO_E_ERROR;
+    }
+    if (dstCapacity < 3) {
+        return LZO_E_OUTPUT_OVERRUN;
+    }
+    const LevelParams& params = LEVELS[std::clamp(level, LZO1X_HC_MIN_LEVEL, LZO1X_HC_MAX_LEVEL) - LZO1X_HC_MIN_LEVEL];
+    const uint32_t n = static_cast<uint32_t>(srcLen);
+
+    s.head.assign(size_t(1) << HASH_BITS, -1);
+    s.chain.resize(n);
+    s.matchCost.assign(n + 1, INF_COST);
+    s.matchLen.resize(n + 1);
+    s.matchDist.resize(n + 1);
+    s.litCost.resize(n + 1);
+    s.litFrom.resize(n + 1);
+
+    // Forward pass: matchCost[i] is the cheapest encoding of src[0, i) whose last
+    // operation is a match ending at i, litCost[i] the cheapest one that may end in a
+    // literal run (starting at litFrom[i]). Runs of 19+ literals cost about the same per
+    // byte, so their best start is kept as a running minimum. Costs are exact byte counts,
+    // so litCost[i] + 3 is the size of the stream for the prefix src[0, i), and the walk
+    // stops once prefixes clearly no longer fit in dst.
+    const uint32_t budget = static_cast<uint32_t>(std::min<size_t>(dstCapacity - 3, INF_COST));
+    uint32_t fitEnd = 0;
+    uint32_t reach = 0;     // furthest end of a relaxed match that is still within budget
+
+    s.matchCost[0] = 0;
+    auto relax = [&](uint32_t i, uint32_t len, uint32_t dist) {
+        uint32_t cost = s.litCost[i] + matchCost(len, dist);
+        if (cost < s.matchCost[i + len]) {
+            s.matchCost[i + len] = cost;
+            s.matchLen[i + len] = len;
+            s.matchDist[i + len] = dist;
+            if (cost <= budget) {
+                reach = std::max(reach, i + len);
+            }
+        }
+    };
+    int64_t longRunBest = INT64_MAX;    // min matchCost[j] - j over j <= i - 19
+    int32_t longRunFrom = -1;
+    uint32_t skipUntil = 0;
+
+    for (uint32_t i = 0; i <= n; i++) {
+        if (i >= 19) {
+            uint32_t j = i - 19;
+            if (s.matchCost[j] < INF_COST && static_cast<int64_t>(s.matchCost[j]) - j < longRunBest) {
+                longRunBest = static_cast<int64_t>(s.matchCost[j]) - j;
+                longRunFrom = static_cast<int32_t>(j);
+            }
+        }
+
+        uint32_t best = s.matchCost[i];
+        int32_t from = static_cast<int32_t>(i);
+        for (uint32_t count = 1; count <= 18 && count <= i; count++) {
+            uint32_t j = i - count;
+            if (s.matchCost[j] >= INF_COST) {
+                continue;
+            }
+            uint32_t cost = s.matchCost[j] + literalRunCost(count, j == 0);
+            if (cost < best) {
+                best = cost;
+                from = static_cast<int32_t>(j);
+            }
+        }
+        if (longRunFrom >= 0) {
+            uint32_t count = i - static_cast<uint32_t>(longRunFrom);
+            uint32_t cost = s.matchCost[longRunFrom] + literalRunCost(count, longRunFrom == 0);
+            if (cost < best) {
+                best = cost;
+                from = longRunFrom;
+            }
+        }
+        s.litCost[i] = best;
+        s.litFrom[i] = from;
+        if (best <= budget) {
+            fitEnd = i;
+        }
+        else if (best > budget + STOP_MARGIN && i >= reach) {
+            break;
+        }
+
+        if (i + MIN_MATCH > n) {
+            continue;
+        }
+
+        // Find matches on the hash chain, nearest first; each candidate that is longer
+        // than the ones before it is the nearest source for the lengths it adds
+        uint32_t h = hash3(src + i);
+        int32_t candidate = s.head[h];
+        s.chain[i] = candidate;
+        s.head[h] = static_cast<int32_t>(i);
+        if (i < skipUntil) {
+            continue;
+        }
+
+        uint32_t maxLen = n - i;
+        uint32_t prevLen = MIN_MATCH - 1;
+        for (uint32_t depth = 0; candidate >= 0 && depth < params.chainDepth; depth++, candidate = s.chain[candidate]) {
+            uint32_t dist = i - static_cast<uint32_t>(candidate);
+            if (dist > M4_MAX_OFFSET) {
+                break;
+            }
+            const unsigned char* a = src + candidate;
+            const unsigned char* b = src + i;
+            if (a[prevLen] != b[prevLen] || a[0] != b[0] || a[1] != b[1]) {
+                continue;
+            }
+            uint32_t len = 2;
+            while (len < maxLen && a[len] == b[len]) {
+                len++;
+            }
+            if (len <= prevLen) {
+                continue;
+            }
+
+            uint32_t top = std::min(len, params.niceLen);
+            for (uint32_t l = prevLen + 1; l <= top; l++) {
+                relax(i, l, dist);
+            }
+            if (len >= params.niceLen) {
+                // Long enough: take the full length and do not parse inside it
+                if (len > top) {
+                    relax(i, len, dist);
+                }
+                skipUntil = i + len;
+                break;
+            }
+            prevLen = len;
+            if (len == maxLen) {
+                break;
+            }
+        }
+    }
+
+    // Walk the parse back from the end of the longest fitting prefix, then emit it front to back
+    s.sequence.clear();
+    uint32_t end = fitEnd;
+    for (;;) {
+        uint32_t litStart = static_cast<uint32_t>(s.litFrom[end]);
+        if (litStart == 0) {
+            break;
+        }
+        uint32_t len = s.matchLen[litStart];
+        s.sequence.push_back(end - litStart);
+        s.sequence.push_back(len);
+        s.sequence.push_back(s.matchDist[litStart]);
+        end = litStart - len;
+    }
+
+    unsigned char* op = dst;
+    op = storeLiterals(op, dst, src, end);
+    uint32_t ip = end;
+    for (size_t k = s.sequence.size(); k > 0; k -= 3) {
+        uint32_t literals = s.sequence[k - 3];
+        uint32_t len = s.sequence[k - 2];
+        uint32_t dist = s.sequence[k - 1];
+        op = storeMatch(op, len, dist);
+        ip += len;
+        op = storeLiterals(op, dst, src + ip, literals);
+        ip += literals;
+    }
+
+    // End of stream marker
+    *op++ = M4_MARKER | 1;
+    *op++ = 0;
+    *op++ = 0;
+
+    consumed = ip;
+    dstLen = static_cast<size_t>(op - dst);
+    return ip == fitEnd && dstLen <= dstCapacity ? LZO_E_OK : LZO_E_ERROR;
+}
+
+int lzo1xHcCompress(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen,
+    int level, Lzo1xHcScratch& scratch) {
+    size_t consumed = 0;
+    int result = lzo1xHcCompressPrefix(src, srcLen, dst, srcLen + srcLen / 16 + 64 + 3, consumed, dstLen, level, scratch);
+    return result == LZO_E_OK && consumed == srcLen ? LZO_E_OK : LZO_E_ERROR;
+}
@@ -0,0 +1,40 @@
+// High-ratio LZO1X encoder
+//
+// miniLZO only ships the fast LZO1X-1 compressor. This encoder produces the same LZO1X
+// stream format (anything lzo1x_decompress_safe accepts, and therefore the game's own
+// decoder) but finds matches with hash chains over the whole 48KB window and chooses
+// between literals and matches with a cost-based optimal parse, trading speed for ratio
+// the way lzo1x_999 does.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr int LZO1X_HC_MIN_LEVEL = 2;
+constexpr int LZO1X_HC_MAX_LEVEL = 9;
+
+// Scratch memory for one compressor; keep one per thread and reuse it between calls
+struct Lzo1xHcScratch {
+    std::vector<int32_t> head;          // most recent position of each 3-byte hash
+    std::vector<int32_t> chain;         // previous position with the same hash
+    std::vector<uint32_t> matchCost;    // cheapest cost of input up to i ending in a match
+    std::vector<uint32_t> matchLen;     // that match's length and distance
+    std::vector<uint32_t> matchDist;
+    std::vector<uint32_t> litCost;      // cheapest cost of input up to i, literals allowed
+    std::vector<int32_t> litFrom;       // where the literal run ending at i starts
+    std::vector<uint32_t> sequence;     // backtracked parse, three words per match
+};
+
+// Compress src[0, srcLen) at the given level (LZO1X_HC_MIN_LEVEL..LZO1X_HC_MAX_LEVEL,
+// higher searches harder). dst must hold at least srcLen + srcLen / 16 + 67 bytes, the
+// LZO1X worst case. Returns LZO_E_OK and sets dstLen to the compressed size.
+int lzo1xHcCompress(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t& dstLen,
+    int level, Lzo1xHcScratch& scratch);
+
+// Like lzo1xHcCompress, but compresses the longest prefix of src[0, srcLen) whose stream fits
+// in dstCapacity bytes (e.g. one block slot) in a single pass. Sets consumed to the prefix
+// length, which is all of src when it fits; fails with LZO_E_OUTPUT_OVERRUN only when
+// dstCapacity cannot hold even an empty stream.
+int lzo1xHcCompressPrefix(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstCapacity,
+    size_t& consumed, size_t& dstLen, int level, Lzo1xHcScratch& scratch);
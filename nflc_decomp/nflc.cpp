@@ -0,0 +1,2524 @@
+#include "nflc.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "minilzo.h"
+}
+
+#include "crc32c.h"
+#include "lzo1x_fast.h"
+
+static_assert(NFLC_OK == LZO_E_OK, "result codes are LZO's");
+
+namespace {
+
+// Streaming: input is packed in batches of whole regions of about this size (larger when
+// there are more threads to keep busy)
+constexpr size_t STREAM_BATCH_BYTES = 4 * 1024 * 1024;
+
+// Levels tried by NFLC_LEVEL_AUTO, fastest first
+constexpr int AUTO_LEVELS[] = { 1, 5, 9 };
+
+bool g_referenceDecoder = false;
+NflcStats g_stats;
+NflcProgress g_progress;
+
+// XXH64 (xxHash, 64-bit variant), the block cache key
+constexpr uint64_t XXH_PRIME1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t XXH_PRIME2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t XXH_PRIME3 = 0x165667B19E3779F9ull;
+constexpr uint64_t XXH_PRIME4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t XXH_PRIME5 = 0x27D4EB2F165667C5ull;
+
+uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    return rotl64(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+uint64_t xxhMerge(uint64_t acc, uint64_t val) {
+    return (acc ^ xxhRound(0, val)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+uint64_t xxh64(const unsigned char* p, size_t len, uint64_t seed) {
+    const unsigned char* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxhMerge(h, v1);
+        h = xxhMerge(h, v2);
+        h = xxhMerge(h, v3);
+        h = xxhMerge(h, v4);
+    }
+    else {
+        h = seed + XXH_PRIME5;
+    }
+    h += len;
+
+    for (; end - p >= 8; p += 8) {
+        h = rotl64(h ^ xxhRound(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (end - p >= 4) {
+        h = rotl64(h ^ (read32(p) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl64(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Block cache files: this header, then the decoded block
+struct CacheFileHeader {
+    char magic[4];          // "nFcB"
+    uint32_t size;          // decoded size
+    uint32_t dataCrc;       // CRC-32C of the decoded block
+    uint32_t reserved;
+};
+
+void growBuffer(std::vector<unsigned char>& buf, size_t size) {
+    if (buf.size() < size) {
+        buf.resize(size);
+    }
+}
+
+// Worst-case LZO1X output size for len input bytes
+constexpr size_t lzoWorstCase(size_t len) {
+    return len + len / 16 + 64 + 3;
+}
+
+// Any input up to this length is guaranteed to fit in a slot, even if it does not compress
+constexpr uint32_t ALWAYS_FITS_CHUNK = static_cast<uint32_t>((NFLC_MAX_PAYLOAD - 67) * 16 / 17);
+static_assert(lzoWorstCase(ALWAYS_FITS_CHUNK) <= NFLC_MAX_PAYLOAD, "ALWAYS_FITS_CHUNK too large");
+static_assert(lzoWorstCase(NflcCodec::CHUNK_SIZE) == NflcCodec::CHUNK_BOUND, "codec chunk bound");
+
+// Stored blocks: input LZO cannot shrink (audio, textures that are already compressed) is
+// written as the cheapest valid LZO1X stream, one literal run and the end marker, which any
+// LZO1X decoder reads and ours turns into a memcpy. Payload size for len stored bytes, with
+// the run length coded as lzo1x_1_compress codes a final literal run:
+constexpr size_t storedSize(size_t len) {
+    return len + 3 + (len <= 238 ? 1 : 2 + (len - 19) / 255);
+}
+
+constexpr uint32_t storedMaxChunk() {
+    uint32_t len = NFLC_MAX_PAYLOAD;
+    while (storedSize(len) > NFLC_MAX_PAYLOAD) {
+        len--;
+    }
+    return len;
+}
+
+// Most input one stored block holds
+constexpr uint32_t STORED_MAX_CHUNK = storedMaxChunk();
+
+// Split-point search: block ends tried back from the one that fills the slot, each a
+// 1/SPLIT_STEP_DIVISOR of the block apart
+constexpr uint32_t SPLIT_CANDIDATES = 8;
+constexpr uint32_t SPLIT_STEP_DIVISOR = 64;
+
+size_t writeStored(const unsigned char* src, uint32_t len, unsigned char* dst) {
+    unsigned char* op = dst;
+    if (len <= 238) {
+        *op++ = static_cast<unsigned char>(17 + len);
+    }
+    else {
+        size_t tt = len - 18;
+        *op++ = 0;
+        while (tt > 255) {
+            tt -= 255;
+            *op++ = 0;
+        }
+        *op++ = static_cast<unsigned char>(tt);
+    }
+    std::memcpy(op, src, len);
+    op += len;
+    *op++ = 0x11;       // M4 match of distance 0: end of stream
+    *op++ = 0;
+    *op++ = 0;
+    return static_cast<size_t>(op - dst);
+}
+
+// If payload is a single literal run and the end marker, set its offset and length
+bool storedRun(const unsigned char* payload, size_t size, size_t& offset, size_t& len) {
+    if (size < 4) {
+        return false;
+    }
+    size_t pos = 1;
+    if (payload[0] > 17) {
+        len = payload[0] - 17u;
+    }
+    else if (payload[0] == 0) {
+        len = 18;
+        while (pos < size && payload[pos] == 0) {
+            len += 255;
+            pos++;
+        }
+        if (pos == size) {
+            return false;
+        }
+        len += payload[pos++];
+    }
+    else if (payload[0] < 16) {
+        len = payload[0] + 3u;
+    }
+    else {
+        return false;
+    }
+    const unsigned char* end = payload + pos + len;
+    if (size - pos < 3 || size - pos - 3 != len || end[0] != 0x11 || end[1] != 0 || end[2] != 0) {
+        return false;
+    }
+    offset = pos;
+    return true;
+}
+
+// Order-0 entropy of a few stripes spread over src, in bits per byte, as a cheap test for
+// data LZO will not shrink. Inputs too short to sample reliably report 0.
+double sampledEntropy(const unsigned char* src, uint32_t len) {
+    constexpr uint32_t STRIPES = 8;
+    constexpr uint32_t STRIPE_SIZE = 512;
+    if (len < STRIPES * STRIPE_SIZE) {
+        return 0.0;
+    }
+    uint32_t counts[256] = {};
+    for (uint32_t s = 0; s < STRIPES; s++) {
+        const unsigned char* p = src + static_cast<uint64_t>(len - STRIPE_SIZE) * s / (STRIPES - 1);
+        for (uint32_t i = 0; i < STRIPE_SIZE; i++) {
+            counts[p[i]]++;
+        }
+    }
+    constexpr double total = STRIPES * STRIPE_SIZE;
+    double bits = 0.0;
+    for (uint32_t c : counts) {
+        if (c != 0) {
+            bits -= c / total * std::log2(c / total);
+        }
+    }
+    return bits;
+}
+
+// With 4096 samples, uniformly random bytes measure about 7.95; blocks this close to 8 get
+// the single confirming trial instead of the full fitting search
+constexpr double STORED_MIN_ENTROPY = 7.9;
+
+int compressChunk(const unsigned char* src, uint32_t len, std::vector<unsigned char>& dst, lzo_uint& compLen, void* workMem) {
+    NflcStageTimer timer(NflcStage::Compress);
+    g_stats.count(NflcCounter::TrialCompressions);
+    growBuffer(dst, lzoWorstCase(len));
+    compLen = dst.size();
+    return lzo1x_1_compress(src, len, dst.data(), &compLen, workMem);
+}
+
+// LZO1X-1 block fitting: find the longest prefix of src[0, limit) whose payload fits in a
+// slot, starting from a trial at guess bytes, and leave the payload in buffers.best.
+// A block that does not fit is shrunk, and one that fits is only grown back towards limit
+// when there is slack in the slot. The search extrapolates from the observed ratio first
+// and then bisects between the longest length known to fit and the shortest known not to,
+// so most blocks settle in a handful of trial compressions.
+int fitBlockFast(const unsigned char* src, uint32_t limit, uint32_t guess, NflcWorkerBuffers& buffers,
+    uint32_t& fitLen, uint32_t& fitComp) {
+    // Stop searching once the payload is this close to the slot size or the bracket is this narrow
+    constexpr uint32_t FILL_SLACK = 64;
+    constexpr uint32_t LENGTH_SLACK = 32;
+
+    void* workMem = buffers.workMem.data();
+    fitLen = 0;                         // longest length compressed and known to fit
+    fitComp = 0;                        // its payload size, held in buffers.best
+    uint32_t failLen = limit + 1;       // shortest length known not to fit
+    guess = std::min(limit, guess);
+
+    for (;;) {
+        lzo_uint trialLen = 0;
+        int result = compressChunk(src, guess, buffers.trial, trialLen, workMem);
+        if (result != NFLC_OK) {
+            return result;
+        }
+
+        uint32_t compSize = static_cast<uint32_t>(trialLen);
+        if (compSize <= NFLC_MAX_PAYLOAD) {
+            fitLen = guess;
+            fitComp = compSize;
+            buffers.best.swap(buffers.trial);
+            if (guess == limit || compSize + FILL_SLACK >= NFLC_MAX_PAYLOAD) {
+                break;
+            }
+        }
+        else {
+            failLen = guess;
+        }
+
+        if (failLen - fitLen <= LENGTH_SLACK) {
+            break;
+        }
+
+        // Extrapolate the length that would fill the slot from this trial's ratio,
+        // keeping it strictly inside the current bracket
+        uint64_t estimate = static_cast<uint64_t>(guess) * (NFLC_MAX_PAYLOAD - FILL_SLACK / 2) / std::max(compSize, 1u);
+        uint32_t lo = std::max(fitLen, std::min(ALWAYS_FITS_CHUNK, limit));
+        uint32_t next = static_cast<uint32_t>(std::min<uint64_t>(estimate, failLen - 1));
+        if (next <= fitLen || next >= failLen || next == guess) {
+            next = fitLen + (failLen - fitLen) / 2;
+        }
+        guess = std::max(next, std::min(lo, failLen - 1));
+        if (guess == 0) {
+            guess = 1;
+        }
+    }
+
+    if (fitLen == 0) {
+        // Did not converge on a fitting length: fall back to one that always fits
+        fitLen = std::min(ALWAYS_FITS_CHUNK, limit);
+        lzo_uint compLen = 0;
+        int result = compressChunk(src, fitLen, buffers.best, compLen, workMem);
+        if (result != NFLC_OK) {
+            return result;
+        }
+        fitComp = static_cast<uint32_t>(compLen);
+    }
+    return NFLC_OK;
+}
+
+// High-ratio block fitting: the optimal parse prices every prefix exactly, so a single pass
+// finds the longest prefix of src[0, limit) that fits in a slot. The payload goes to dst.
+int fitBlockHc(const unsigned char* src, uint32_t limit, int level, NflcWorkerBuffers& buffers,
+    std::vector<unsigned char>& dst, uint32_t& fitLen, uint32_t& fitComp) {
+    NflcStageTimer timer(NflcStage::Compress);
+    g_stats.count(NflcCounter::TrialCompressions);
+    growBuffer(dst, NFLC_MAX_PAYLOAD);
+    size_t consumed = 0;
+    size_t compLen = 0;
+    int result = lzo1xHcCompressPrefix(src, limit, dst.data(), NFLC_MAX_PAYLOAD, consumed, compLen,
+        level, buffers.hc);
+    fitLen = static_cast<uint32_t>(consumed);
+    fitComp = static_cast<uint32_t>(compLen);
+    return result;
+}
+
+// Fit the next block at the given level, leaving its payload in buffers.best. NFLC_LEVEL_AUTO
+// fits it at each of AUTO_LEVELS and keeps the result covering the most input, or the
+// smaller payload when two cover the same.
+int fitBlock(const unsigned char* src, uint32_t limit, int level, uint32_t guess, NflcWorkerBuffers& buffers,
+    uint32_t& fitLen, uint32_t& fitComp) {
+    // Incompressible input skips the fitting search and is stored. High byte entropy alone
+    // does not rule out long-range repeats (duplicated pre-compressed assets, repeated audio
+    // frames), so one LZO1X-1 trial over the block has to confirm that LZO gains nothing.
+    uint32_t storedLen = std::min(limit, STORED_MAX_CHUNK);
+    if (sampledEntropy(src, storedLen) >= STORED_MIN_ENTROPY) {
+        lzo_uint trialLen = 0;
+        int result = compressChunk(src, storedLen, buffers.trial, trialLen, buffers.workMem.data());
+        if (result != NFLC_OK) {
+            return result;
+        }
+        if (trialLen >= storedLen) {
+            g_stats.count(NflcCounter::StoredBlocks);
+            growBuffer(buffers.best, storedSize(storedLen));
+            fitLen = storedLen;
+            fitComp = static_cast<uint32_t>(writeStored(src, storedLen, buffers.best.data()));
+            return NFLC_OK;
+        }
+    }
+
+    if (level != NFLC_LEVEL_AUTO) {
+        if (level <= 1) {
+            return fitBlockFast(src, limit, guess, buffers, fitLen, fitComp);
+        }
+        return fitBlockHc(src, limit, level, buffers, buffers.best, fitLen, fitComp);
+    }
+
+    static_assert(AUTO_LEVELS[0] == 1, "the LZO1X-1 fit runs first and leaves its payload in best");
+    int result = fitBlockFast(src, limit, guess, buffers, fitLen, fitComp);
+    for (size_t k = 1; k < std::size(AUTO_LEVELS) && result == NFLC_OK; k++) {
+        uint32_t len = 0;
+        uint32_t comp = 0;
+        result = fitBlockHc(src, limit, AUTO_LEVELS[k], buffers, buffers.alt, len, comp);
+        if (result == NFLC_OK && (len > fitLen || (len == fitLen && comp < fitComp))) {
+            buffers.best.swap(buffers.alt);
+            fitLen = len;
+            fitComp = comp;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+const char* const NFLC_STAGE_NAMES[] = {
+    "io_read", "header_parse", "lzo_decompress_safe", "lzo_decompress_unchecked",
+    "checksum", "block_cache", "lzo_compress", "padding", "output_write"
+};
+const char* const NFLC_COUNTER_NAMES[] = {
+    "bytes_in", "bytes_out", "blocks", "empty_blocks", "bad_headers",
+    "unchecked_blocks", "verify_cache_hits", "checksum_blocks", "checksum_errors",
+    "cache_hits", "cache_misses", "reused_blocks", "resynced_headers", "trial_compressions", "stored_blocks", "padding_bytes"
+};
+static_assert(std::size(NFLC_STAGE_NAMES) == static_cast<size_t>(NflcStage::Count), "stage names");
+static_assert(std::size(NFLC_COUNTER_NAMES) == static_cast<size_t>(NflcCounter::Count), "counter names");
+
+NflcStats& nflcStats() {
+    return g_stats;
+}
+
+NflcProgress& nflcProgress() {
+    return g_progress;
+}
+
+bool nflcInit() {
+    return lzo_init() == LZO_E_OK;
+}
+
+void nflcUseReferenceDecoder(bool reference) {
+    g_referenceDecoder = reference;
+}
+
+const char* nflcDecoderName() {
+    return g_referenceDecoder ? "minilzo" : lzo1xFastKernel();
+}
+
+bool NflcMappedFile::open(const std::string& path) {
+    NflcStageTimer timer(NflcStage::IoRead);
+    close();
+#ifdef _WIN32
+    fileHandle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle_, &fileSize)) {
+        close();
+        return false;
+    }
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+    if (size_ == 0) {
+        return true;
+    }
+    mappingHandle_ = CreateFileMappingA(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle_ != nullptr) {
+        void* view = MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0);
+        if (view != nullptr) {
+            data_ = static_cast<const unsigned char*>(view);
+            return true;
+        }
+    }
+#else
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        close();
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+        return true;
+    }
+    void* view = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (view != MAP_FAILED) {
+        // Start the kernel reading the whole file in the background, so the page faults of
+        // the decode workers mostly find it already in memory (a hint; failure is harmless)
+        posix_madvise(view, size_, POSIX_MADV_WILLNEED);
+        data_ = static_cast<const unsigned char*>(view);
+        return true;
+    }
+#endif
+    // Mapping failed: fall back to an in-memory copy
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        close();
+        return false;
+    }
+    fallback_.resize(size_);
+    fallback_.resize(std::fread(fallback_.data(), 1, size_, f));
+    std::fclose(f);
+    size_ = fallback_.size();
+    data_ = fallback_.data();
+    return true;
+}
+
+void NflcMappedFile::close() {
+    bool mapped = data_ != nullptr && fallback_.empty();
+#ifdef _WIN32
+    if (mapped) {
+        UnmapViewOfFile(data_);
+    }
+    if (mappingHandle_ != nullptr) {
+        CloseHandle(mappingHandle_);
+        mappingHandle_ = nullptr;
+    }
+    if (fileHandle_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle_);
+        fileHandle_ = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (mapped) {
+        munmap(const_cast<unsigned char*>(data_), size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+#endif
+    fallback_.clear();
+    data_ = nullptr;
+    size_ = 0;
+}
+
+uint32_t nflcBlockCount(size_t fileSize) {
+    return NflcCodec::slotCount(fileSize);
+}
+
+bool nflcReadBlockHeader(NflcByteSpan in, uint32_t blockNum, NflcBlockHeader& hdr) {
+    NflcStageTimer timer(NflcStage::HeaderParse);
+    size_t offset = NflcCodec::slotOffset(blockNum);
+    if (offset > in.size() || in.size() - offset < NflcCodec::HEADER_SIZE) {
+        return false;
+    }
+    return NflcCodec::loadHeader(in.data() + offset, hdr);
+}
+
+NflcBlockCrc nflcBlockCrc(const NflcBlockHeader& hdr) {
+    NflcBlockCrc crc;
+    crc.present = hdr.crcTag == NFLC_CRC_TAG;
+    crc.payload = hdr.payloadCrc;
+    crc.data = hdr.dataCrc;
+    return crc;
+}
+
+const char* const NFLC_SCAN_PROBLEM_NAMES[6] = {
+    "bad_magic", "block_index", "zoffset_chain", "uncomp_offset_chain", "truncated", "totals",
+};
+
+bool nflcScanArchive(NflcByteSpan in, NflcScan& scan) {
+    NflcStageTimer timer(NflcStage::HeaderParse);
+    scan = NflcScan();
+    if (in.size() < sizeof(NflcBlockHeader) || std::memcmp(in.data(), "nFlC", 4) != 0) {
+        return false;
+    }
+    NflcBlockHeader first;
+    NflcCodec::loadHeader(in.data(), first);
+    scan.totalZSize = first.totalZSize;
+    scan.totalUncompSize = first.totalUncompSize;
+
+    uint32_t numBlocks = nflcBlockCount(in.size());
+    scan.slots.resize(numBlocks);
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        NflcSlotInfo& info = scan.slots[i];
+        size_t slotStart = NflcCodec::slotOffset(i);
+        size_t slotEnd = std::min<size_t>(slotStart + NFLC_BLOCK_SIZE, in.size());
+        info.slot = i;
+        info.problems = 0;
+        std::memset(&info.hdr, 0, sizeof(info.hdr));
+
+        // Headers are copied straight out of the view; nflcReadBlockHeader would time each one
+        if (slotEnd - slotStart < sizeof(info.hdr) || std::memcmp(in.data() + slotStart, "nFlC", 4) != 0) {
+            info.padding = static_cast<uint32_t>(slotEnd - slotStart);
+            info.problems = NFLC_SCAN_BAD_MAGIC;
+        }
+        else {
+            NflcBlockHeader& hdr = info.hdr;
+            NflcCodec::loadHeader(in.data() + slotStart, hdr);
+            size_t payloadEnd = slotStart + NFLC_HEADER_SIZE + hdr.zsize;
+            info.padding = payloadEnd < slotEnd ? static_cast<uint32_t>(slotEnd - payloadEnd) : 0;
+            if (hdr.blockIndex != static_cast<uint16_t>(i)) {
+                info.problems |= NFLC_SCAN_INDEX;
+            }
+            if (hdr.prevZOffset != scan.sumZSize) {
+                info.problems |= NFLC_SCAN_ZOFFSET;
+            }
+            if (hdr.prevUncompOffset != scan.sumUncompSize) {
+                info.problems |= NFLC_SCAN_UNCOMP_OFFSET;
+            }
+            if (payloadEnd > slotEnd) {
+                info.problems |= NFLC_SCAN_TRUNCATED;
+            }
+            if (hdr.totalZSize != scan.totalZSize || hdr.totalUncompSize != scan.totalUncompSize) {
+                info.problems |= NFLC_SCAN_TOTALS;
+            }
+            scan.sumZSize += hdr.zsize;
+            scan.sumUncompSize += hdr.blockUncompSize;
+            scan.validBlocks++;
+        }
+        scan.paddingBytes += info.padding;
+        scan.problems |= info.problems;
+    }
+    if (scan.sumZSize != scan.totalZSize || scan.sumUncompSize != scan.totalUncompSize) {
+        scan.problems |= NFLC_SCAN_TOTALS;
+    }
+    return true;
+}
+
+namespace {
+
+// CPUs nflcPinThread() hands out, in order; empty while pinning is off
+std::vector<unsigned> g_workerCpus;
+
+}  // namespace
+
+void nflcSetWorkerAffinity(bool pin) {
+    g_workerCpus.clear();
+    if (!pin) {
+        return;
+    }
+#ifdef _WIN32
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for (unsigned cpu = 0; cpu < sizeof(DWORD_PTR) * 8; cpu++) {
+            if (processMask & (DWORD_PTR{ 1 } << cpu)) {
+                g_workerCpus.push_back(cpu);
+            }
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                g_workerCpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+}
+
+bool nflcWorkerAffinity() {
+    return !g_workerCpus.empty();
+}
+
+void nflcPinThread(unsigned worker) {
+    if (g_workerCpus.empty()) {
+        return;
+    }
+    unsigned cpu = g_workerCpus[worker % g_workerCpus.size()];
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{ 1 } << cpu);
+#elif defined(__linux__)
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+#else
+    (void)cpu;
+#endif
+}
+
+std::string nflcErrorText(int code) {
+    if (code == NFLC_E_PAYLOAD_CRC) {
+        return "compressed data checksum mismatch";
+    }
+    if (code == NFLC_E_DATA_CRC) {
+        return "decompressed data checksum mismatch";
+    }
+    if (code == NFLC_E_CANCELLED) {
+        return "cancelled";
+    }
+    if (code == NFLC_E_OVERLAP) {
+        return "overlaps a block already recovered";
+    }
+    return "decompression failed (code " + std::to_string(code) + ")";
+}
+
+bool nflcParseCount(const std::string& text, uint64_t max, uint64_t& value) {
+    const char* end = text.data() + text.size();
+    std::from_chars_result r = std::from_chars(text.data(), end, value);
+    return r.ec == std::errc() && r.ptr == end && value <= max;
+}
+
+NflcBlockCache::NflcBlockCache(size_t memoryBytes, std::string directory)
+    : memoryBytes_(memoryBytes), directory_(std::move(directory)) {
+    if (!directory_.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory_, ec);
+    }
+}
+
+uint64_t NflcBlockCache::key(const unsigned char* compData, size_t compSize, size_t uncompSize) {
+    return xxh64(compData, compSize, (static_cast<uint64_t>(uncompSize) << 32) | static_cast<uint32_t>(compSize));
+}
+
+std::string NflcBlockCache::filePath(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%02x/%016llx.blk", static_cast<unsigned>(key >> 56),
+        static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory_) / name).string();
+}
+
+void NflcBlockCache::insert(uint64_t key, const unsigned char* data, size_t size) {
+    if (size > memoryBytes_ || index_.count(key) != 0) {
+        return;
+    }
+    while (used_ + size > memoryBytes_ && !lru_.empty()) {
+        used_ -= lru_.back().data.size();
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+    lru_.push_front(Entry{ key, std::vector<unsigned char>(data, data + size) });
+    index_[key] = lru_.begin();
+    used_ += size;
+}
+
+bool NflcBlockCache::lookup(uint64_t key, unsigned char* out, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            if (it->second->data.size() != size) {
+                misses_++;
+                return false;
+            }
+            lru_.splice(lru_.begin(), lru_, it->second);
+            std::memcpy(out, it->second->data.data(), size);
+            hits_++;
+            return true;
+        }
+    }
+    if (directory_.empty()) {
+        misses_++;
+        return false;
+    }
+
+    // The file is only trusted if it is complete and its checksum matches
+    std::string path = filePath(key);
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        misses_++;
+        return false;
+    }
+    CacheFileHeader hdr;
+    bool ok = std::fread(&hdr, sizeof(hdr), 1, f) == 1 && std::memcmp(hdr.magic, "nFcB", 4) == 0 &&
+        hdr.size == size && std::fread(out, 1, size, f) == size && crc32c(out, size) == hdr.dataCrc;
+    std::fclose(f);
+    if (!ok) {
+        // Damaged: drop it so store() writes a good copy
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        misses_++;
+        return false;
+    }
+    hits_++;
+    std::lock_guard<std::mutex> lock(mutex_);
+    insert(key, out, size);
+    return true;
+}
+
+void NflcBlockCache::store(uint64_t key, const unsigned char* data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert(key, data, size);
+    }
+    if (directory_.empty()) {
+        return;
+    }
+
+    std::string path = filePath(key);
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) {
+        return;
+    }
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    // Written under a unique name and renamed into place, so readers never see a partial file
+    std::string temp = path + "." + std::to_string(tempCounter_.fetch_add(1)) + "." +
+        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::FILE* f = std::fopen(temp.c_str(), "wb");
+    if (f == nullptr) {
+        return;
+    }
+    CacheFileHeader hdr = {};
+    std::memcpy(hdr.magic, "nFcB", 4);
+    hdr.size = static_cast<uint32_t>(size);
+    hdr.dataCrc = crc32c(data, size);
+    bool ok = std::fwrite(&hdr, sizeof(hdr), 1, f) == 1 && std::fwrite(data, 1, size, f) == size;
+    ok = std::fclose(f) == 0 && ok;
+    if (ok) {
+        std::filesystem::rename(temp, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        std::filesystem::remove(temp, ec);
+    }
+}
+
+int nflcDecodePayload(const unsigned char* compData, size_t compSize, unsigned char* out, size_t& outLen,
+    const NflcBlockCrc& crc, bool trusted, NflcBlockCache* cache) {
+    if (g_progress.cancelled()) {
+        outLen = 0;
+        return NFLC_E_CANCELLED;
+    }
+    // The payload checksum is checked even when trusted: it is all that ties the bytes fed to
+    // the unchecked decoder to the ones that were verified, and costs one CRC of the
+    // compressed block. trusted only skips the output checksum.
+    bool checkPayload = crc.present;
+    bool checkData = crc.present && !trusted;
+    size_t expectedLen = outLen;
+
+    // Stored blocks are copied; unless the reference decoder was asked for
+    size_t storedOffset = 0;
+    size_t storedLen = 0;
+    if (!g_referenceDecoder && storedRun(compData, compSize, storedOffset, storedLen) && storedLen <= outLen) {
+        if (checkPayload) {
+            NflcStageTimer timer(NflcStage::Checksum);
+            if (crc32c(compData, compSize) != crc.payload) {
+                g_stats.count(NflcCounter::ChecksumErrors);
+                outLen = 0;
+                return NFLC_E_PAYLOAD_CRC;
+            }
+        }
+        {
+            NflcStageTimer timer(trusted ? NflcStage::DecompressUnchecked : NflcStage::Decompress);
+            std::memcpy(out, compData + storedOffset, storedLen);
+            outLen = storedLen;
+        }
+        if (checkData) {
+            NflcStageTimer timer(NflcStage::Checksum);
+            g_stats.count(NflcCounter::ChecksumBlocks);
+            if (crc32c(out, outLen) != crc.data) {
+                g_stats.count(NflcCounter::ChecksumErrors);
+                return NFLC_E_DATA_CRC;
+            }
+        }
+        g_stats.count(NflcCounter::StoredBlocks);
+        g_stats.count(NflcCounter::Blocks);
+        g_stats.count(NflcCounter::BytesIn, compSize);
+        g_stats.count(NflcCounter::BytesOut, outLen);
+        g_progress.advance(outLen);
+        return NFLC_OK;
+    }
+
+    uint64_t cacheKey = 0;
+    if (cache != nullptr) {
+        NflcStageTimer timer(NflcStage::BlockCache);
+        cacheKey = NflcBlockCache::key(compData, compSize, outLen);
+        if (cache->lookup(cacheKey, out, outLen) && (!checkData || crc32c(out, outLen) == crc.data)) {
+            g_stats.count(NflcCounter::CacheHits);
+            g_stats.count(NflcCounter::Blocks);
+            g_stats.count(NflcCounter::BytesIn, compSize);
+            g_stats.count(NflcCounter::BytesOut, outLen);
+            g_progress.advance(outLen);
+            return NFLC_OK;
+        }
+        g_stats.count(NflcCounter::CacheMisses);
+    }
+
+    if (checkPayload) {
+        NflcStageTimer timer(NflcStage::Checksum);
+        if (crc32c(compData, compSize) != crc.payload) {
+            g_stats.count(NflcCounter::ChecksumErrors);
+            outLen = 0;
+            return NFLC_E_PAYLOAD_CRC;
+        }
+    }
+
+    int result;
+    if (trusted) {
+        NflcStageTimer timer(NflcStage::DecompressUnchecked);
+        g_stats.count(NflcCounter::UncheckedBlocks);
+        if (g_referenceDecoder) {
+            lzo_uint len = outLen;
+            result = lzo1x_decompress(compData, compSize, out, &len, nullptr);
+            outLen = len;
+        }
+        else {
+            result = lzo1xDecompressFastUnchecked(compData, compSize, out, outLen);
+        }
+    }
+    else {
+        NflcStageTimer timer(NflcStage::Decompress);
+        if (g_referenceDecoder) {
+            lzo_uint len = outLen;
+            result = lzo1x_decompress_safe(compData, compSize, out, &len, nullptr);
+            outLen = len;
+        }
+        else {
+            result = lzo1xDecompressFast(compData, compSize, out, outLen);
+        }
+    }
+
+    if (checkData && result == NFLC_OK) {
+        NflcStageTimer timer(NflcStage::Checksum);
+        g_stats.count(NflcCounter::ChecksumBlocks);
+        if (crc32c(out, outLen) != crc.data) {
+            g_stats.count(NflcCounter::ChecksumErrors);
+            result = NFLC_E_DATA_CRC;
+        }
+    }
+
+    if (result == NFLC_OK) {
+        g_stats.count(NflcCounter::Blocks);
+        g_stats.count(NflcCounter::BytesIn, compSize);
+        g_stats.count(NflcCounter::BytesOut, outLen);
+        g_progress.advance(outLen);
+        if (cache != nullptr && outLen == expectedLen) {
+            NflcStageTimer timer(NflcStage::BlockCache);
+            cache->store(cacheKey, out, outLen);
+        }
+    }
+    return result;
+}
+
+void nflcDecodeSlot(NflcByteSpan in, uint32_t blockNum, std::span<unsigned char> out, NflcSlotResult& res, bool trusted,
+    NflcBlockCache* cache) {
+    // Read block header
+    NflcBlockHeader hdr;
+    if (!nflcReadBlockHeader(in, blockNum, hdr)) {
+        g_stats.count(NflcCounter::BadHeaders);
+        res.status = NflcSlotStatus::BadMagic;
+        return;
+    }
+
+    // Determine compressed data size for this block
+    uint32_t compSize = hdr.zsize;
+    uint32_t uncompSize = hdr.blockUncompSize;
+    res.compSize = compSize;
+    res.outOffset = hdr.prevUncompOffset;
+
+    if (uncompSize == 0) {
+        g_stats.count(NflcCounter::EmptyBlocks);
+        res.status = NflcSlotStatus::Empty;
+        return;
+    }
+
+    // Make sure we don't overflow output buffer
+    if (hdr.prevUncompOffset > out.size() || uncompSize > out.size() - hdr.prevUncompOffset) {
+        res.status = NflcSlotStatus::Overflow;
+        return;
+    }
+
+    // The compressed payload is decoded in place, right after the header
+    size_t payloadOffset = NflcCodec::payloadOffset(blockNum);
+    const unsigned char* compData = in.data() + payloadOffset;
+    size_t available = in.size() - payloadOffset;
+    if (compSize > available) {
+        compSize = static_cast<uint32_t>(available);
+    }
+    res.bytesRead = compSize;
+
+    // Decompress this block
+    size_t outLen = uncompSize;
+    int result = nflcDecodePayload(compData, compSize, out.data() + hdr.prevUncompOffset, outLen, nflcBlockCrc(hdr), trusted, cache);
+
+    res.lzoResult = result;
+    res.outLen = outLen;
+    res.status = (result == NFLC_OK) ? NflcSlotStatus::Ok : NflcSlotStatus::Failed;
+}
+
+size_t nflcZeroUnwritten(std::span<unsigned char> out, const std::vector<NflcSlotResult>& results) {
+    std::vector<std::pair<size_t, size_t>> produced;
+    for (const NflcSlotResult& res : results) {
+        if (res.status == NflcSlotStatus::Ok) {
+            produced.emplace_back(res.outOffset, res.outOffset + res.outLen);
+        }
+    }
+    std::sort(produced.begin(), produced.end());
+    size_t cursor = 0;
+    for (const std::pair<size_t, size_t>& p : produced) {
+        if (p.first > cursor) {
+            std::memset(out.data() + cursor, 0, p.first - cursor);
+        }
+        cursor = std::max(cursor, p.second);
+    }
+    size_t end = cursor;
+    if (cursor < out.size()) {
+        std::memset(out.data() + cursor, 0, out.size() - cursor);
+    }
+    return end;
+}
+
+std::vector<NflcWorkerBuffers> nflcMakeWorkerBuffers(unsigned count, bool compressing) {
+    std::vector<NflcWorkerBuffers> buffers(std::max(count, 1u));
+    if (compressing) {
+        // A fixed-size chunk's trials fit in CHUNK_BOUND, so the default geometry never grows these
+        for (NflcWorkerBuffers& wb : buffers) {
+            wb.workMem.resize(LZO1X_1_MEM_COMPRESS);
+            wb.trial.resize(NflcCodec::CHUNK_BOUND);
+            wb.best.resize(NflcCodec::CHUNK_BOUND);
+        }
+    }
+    return buffers;
+}
+
+namespace {
+
+// Largest blockUncompSize recovery believes; anything bigger is a damaged header
+constexpr uint32_t RECOVER_MAX_BLOCK = 16 * 1024 * 1024;
+
+bool plausibleHeader(const NflcBlockHeader& hdr) {
+    return hdr.zsize > 0 && hdr.zsize <= NFLC_MAX_PAYLOAD && hdr.blockUncompSize > 0 &&
+        hdr.blockUncompSize <= RECOVER_MAX_BLOCK;
+}
+
+// Offset of the next nFlC magic at or after from, or in.size(). memchr does the scanning
+// (vectorised in every C library we build with) and only candidate bytes are compared.
+size_t findMagic(NflcByteSpan in, size_t from) {
+    const unsigned char* base = in.data();
+    size_t end = in.size() >= 4 ? in.size() - 3 : 0;
+    while (from < end) {
+        const void* hit = std::memchr(base + from, 'n', end - from);
+        if (hit == nullptr) {
+            break;
+        }
+        size_t pos = static_cast<size_t>(static_cast<const unsigned char*>(hit) - base);
+        if (std::memcmp(base + pos, "nFlC", 4) == 0) {
+            return pos;
+        }
+        from = pos + 1;
+    }
+    return in.size();
+}
+
+}  // namespace
+
+bool nflcRecover(NflcByteSpan in, std::vector<unsigned char>& out, NflcRecovery& report, unsigned numThreads,
+    uint64_t maxOutput) {
+    report = NflcRecovery();
+    struct Candidate {
+        size_t offset;
+        NflcBlockHeader hdr;
+    };
+    std::vector<Candidate> candidates;
+
+    // Follow the slot grid from each header found; where the next slot has no header scan for
+    // one, starting after this block's payload if the header looked sound
+    {
+        NflcStageTimer timer(NflcStage::HeaderParse);
+        size_t pos = findMagic(in, 0);
+        while (pos + sizeof(NflcBlockHeader) <= in.size()) {
+            Candidate c;
+            c.offset = pos;
+            NflcCodec::loadHeader(in.data() + pos, c.hdr);
+            bool plausible = plausibleHeader(c.hdr);
+            if (plausible) {
+                if (pos % NFLC_BLOCK_SIZE != 0) {
+                    report.resynced++;
+                    nflcStats().count(NflcCounter::ResyncedHeaders);
+                }
+                candidates.push_back(c);
+            }
+            else {
+                nflcStats().count(NflcCounter::BadHeaders);
+            }
+            size_t next = pos + NFLC_BLOCK_SIZE;
+            if (next + 4 <= in.size() && std::memcmp(in.data() + next, "nFlC", 4) == 0) {
+                pos = next;
+            }
+            else {
+                size_t from = plausible ? pos + NFLC_HEADER_SIZE + c.hdr.zsize : pos + 4;
+                pos = findMagic(in, std::min(from, in.size()));
+            }
+        }
+    }
+    if (candidates.empty()) {
+        report.error = "No NFLC block headers found";
+        return false;
+    }
+
+    // Output size. Neither the totals nor the offsets of a damaged archive can be taken on
+    // trust, so nothing may claim more than every slot of the input could decode to. Below
+    // that, the output reaches the end of the furthest block found, or the totalUncompSize
+    // most headers agree on when that covers every such block (blocks may be lost at the end).
+    uint64_t slots = nflcBlockCount(in.size()) + report.resynced;
+    uint64_t limit = std::min<uint64_t>(maxOutput,
+        slots * std::min<uint64_t>(RECOVER_MAX_BLOCK, nflcMaxDecodedSize(NFLC_MAX_PAYLOAD)));
+    uint64_t extent = 0;
+    for (const Candidate& c : candidates) {
+        uint64_t end = static_cast<uint64_t>(c.hdr.prevUncompOffset) + c.hdr.blockUncompSize;
+        if (end <= limit) {
+            extent = std::max(extent, end);
+        }
+    }
+    std::unordered_map<uint32_t, uint32_t> votes;
+    uint32_t votedTotal = 0;
+    uint32_t bestVotes = 0;
+    for (const Candidate& c : candidates) {
+        if (c.hdr.totalUncompSize > limit) {
+            continue;
+        }
+        uint32_t n = ++votes[c.hdr.totalUncompSize];
+        if (n > bestVotes) {
+            bestVotes = n;
+            votedTotal = c.hdr.totalUncompSize;
+        }
+    }
+    uint64_t totalUncompSize = bestVotes > 0 && votedTotal >= extent ? votedTotal : extent;
+    try {
+        out.assign(static_cast<size_t>(totalUncompSize), 0);
+    }
+    catch (const std::bad_alloc&) {
+        report.error = "Cannot allocate " + std::to_string(totalUncompSize) + " bytes of output";
+        return false;
+    }
+
+    report.blocks.resize(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const NflcBlockHeader& hdr = candidates[i].hdr;
+        NflcRecoveredBlock& b = report.blocks[i];
+        b.fileOffset = candidates[i].offset;
+        b.uncompOffset = hdr.prevUncompOffset;
+        b.uncompSize = hdr.blockUncompSize;
+        b.result = static_cast<uint64_t>(hdr.prevUncompOffset) + hdr.blockUncompSize > totalUncompSize
+            ? LZO_E_OUTPUT_OVERRUN : NFLC_OK;
+    }
+
+    // Blocks whose output range overlaps no other one are decoded in place and in parallel;
+    // the rest afterwards, one at a time, so a bogus header cannot clobber a good block
+    std::vector<size_t> byOffset;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (report.blocks[i].result == NFLC_OK) {
+            byOffset.push_back(i);
+        }
+    }
+    std::stable_sort(byOffset.begin(), byOffset.end(), [&](size_t a, size_t b) {
+        return report.blocks[a].uncompOffset < report.blocks[b].uncompOffset;
+    });
+    std::vector<bool> overlapping(candidates.size(), false);
+    uint64_t maxEnd = 0;
+    for (size_t n = 0; n < byOffset.size(); n++) {
+        const NflcRecoveredBlock& b = report.blocks[byOffset[n]];
+        if (n > 0 && b.uncompOffset < maxEnd) {
+            overlapping[byOffset[n]] = true;
+            for (size_t k = n; k-- > 0 && report.blocks[byOffset[k]].uncompOffset + static_cast<uint64_t>(report.blocks[byOffset[k]].uncompSize) > b.uncompOffset;) {
+                overlapping[byOffset[k]] = true;
+            }
+        }
+        maxEnd = std::max<uint64_t>(maxEnd, static_cast<uint64_t>(b.uncompOffset) + b.uncompSize);
+    }
+
+    auto decode = [&](size_t i, unsigned char* dest) {
+        const Candidate& c = candidates[i];
+        size_t payload = c.offset + NFLC_HEADER_SIZE;
+        size_t compSize = std::min<size_t>(c.hdr.zsize, in.size() - std::min(payload, in.size()));
+        size_t outLen = c.hdr.blockUncompSize;
+        int result = nflcDecodePayload(in.data() + payload, compSize, dest, outLen, nflcBlockCrc(c.hdr), false);
+        return result == NFLC_OK && outLen != c.hdr.blockUncompSize ? LZO_E_INPUT_OVERRUN : result;
+    };
+
+    std::vector<size_t> inPlace;
+    for (size_t i : byOffset) {
+        if (!overlapping[i]) {
+            inPlace.push_back(i);
+        }
+    }
+    nflcParallelFor(static_cast<uint32_t>(inPlace.size()), std::max(numThreads, 1u), [&](uint32_t n, unsigned) {
+        NflcRecoveredBlock& b = report.blocks[inPlace[n]];
+        b.result = decode(inPlace[n], out.data() + b.uncompOffset);
+        if (b.result != NFLC_OK) {
+            std::memset(out.data() + b.uncompOffset, 0, b.uncompSize);
+        }
+    });
+
+    // Overlapping blocks in file order: the first to decode cleanly keeps its range
+    std::vector<std::pair<uint64_t, uint64_t>> placed;
+    std::vector<unsigned char> scratch;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (!overlapping[i]) {
+            continue;
+        }
+        NflcRecoveredBlock& b = report.blocks[i];
+        uint64_t start = b.uncompOffset;
+        uint64_t end = start + b.uncompSize;
+        scratch.resize(b.uncompSize);
+        b.result = decode(i, scratch.data());
+        for (const std::pair<uint64_t, uint64_t>& p : placed) {
+            if (b.result == NFLC_OK && start < p.second && p.first < end) {
+                b.result = NFLC_E_OVERLAP;
+            }
+        }
+        if (b.result == NFLC_OK) {
+            std::memcpy(out.data() + start, scratch.data(), b.uncompSize);
+            placed.emplace_back(start, end);
+        }
+    }
+
+    // Damaged ranges: whatever no cleanly decoded block covers
+    std::vector<std::pair<uint64_t, uint64_t>> good;
+    for (const NflcRecoveredBlock& b : report.blocks) {
+        if (b.result == NFLC_OK) {
+            good.emplace_back(b.uncompOffset, static_cast<uint64_t>(b.uncompOffset) + b.uncompSize);
+        }
+    }
+    std::sort(good.begin(), good.end());
+    uint64_t covered = 0;
+    for (const std::pair<uint64_t, uint64_t>& g : good) {
+        if (g.first > covered) {
+            report.damaged.emplace_back(covered, g.first - covered);
+        }
+        covered = std::max(covered, g.second);
+    }
+    if (covered < totalUncompSize) {
+        report.damaged.emplace_back(covered, totalUncompSize - covered);
+    }
+    return true;
+}
+
+bool NflcReader::open(const std::string& path) {
+    blocks_.clear();
+    if (!file_.open(path)) {
+        error_ = "Cannot open input file: " + path;
+        return false;
+    }
+    data_ = file_.view();
+    return index();
+}
+
+bool NflcReader::open(NflcByteSpan archive) {
+    blocks_.clear();
+    file_.close();
+    data_ = archive;
+    return index();
+}
+
+bool NflcReader::index() {
+    NflcBlockHeader firstHdr;
+    if (!nflcReadBlockHeader(data_, 0, firstHdr)) {
+        error_ = "Not an NFLC file";
+        return false;
+    }
+    totalUncompSize_ = firstHdr.totalUncompSize;
+
+    uint32_t numBlocks = nflcBlockCount(data_.size());
+    blocks_.reserve(numBlocks);
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        NflcBlockHeader hdr;
+        if (!nflcReadBlockHeader(data_, i, hdr) || hdr.blockUncompSize == 0) {
+            continue;
+        }
+        size_t payloadOffset = NflcCodec::payloadOffset(i);
+        BlockEntry entry;
+        entry.slot = i;
+        entry.compSize = static_cast<uint32_t>(std::min<size_t>(hdr.zsize, data_.size() - payloadOffset));
+        entry.uncompOffset = hdr.prevUncompOffset;
+        entry.uncompSize = hdr.blockUncompSize;
+        entry.crc = nflcBlockCrc(hdr);
+        blocks_.push_back(entry);
+    }
+
+    // Headers are written in order, but don't rely on it for the binary search
+    std::stable_sort(blocks_.begin(), blocks_.end(), [](const BlockEntry& a, const BlockEntry& b) {
+        return a.uncompOffset < b.uncompOffset;
+    });
+    return true;
+}
+
+std::pair<size_t, size_t> NflcReader::findBlocks(uint64_t offset, uint64_t length) const {
+    auto byOffset = [](uint64_t value, const BlockEntry& e) { return value < e.uncompOffset; };
+    auto first = std::upper_bound(blocks_.begin(), blocks_.end(), offset, byOffset);
+    if (first != blocks_.begin() && static_cast<uint64_t>(std::prev(first)->uncompOffset) + std::prev(first)->uncompSize > offset) {
+        --first;
+    }
+    auto last = std::upper_bound(first, blocks_.end(), offset + length - (length ? 1 : 0), byOffset);
+    if (length == 0) {
+        last = first;
+    }
+    return { static_cast<size_t>(first - blocks_.begin()), static_cast<size_t>(last - blocks_.begin()) };
+}
+
+int NflcReader::decodeBlock(size_t i, std::span<unsigned char> out, size_t& outLen) const {
+    const BlockEntry& e = blocks_[i];
+    if (out.size() < e.uncompSize) {
+        outLen = 0;
+        return LZO_E_OUTPUT_OVERRUN;
+    }
+    const unsigned char* compData = data_.data() + NflcCodec::payloadOffset(e.slot);
+    outLen = e.uncompSize;
+    return nflcDecodePayload(compData, e.compSize, out.data(), outLen, e.crc, trusted_, cache_);
+}
+
+bool NflcReader::verify(unsigned numThreads) {
+    uint32_t count = static_cast<uint32_t>(blocks_.size());
+    numThreads = std::min<unsigned>(numThreads, std::max<uint32_t>(count, 1));
+    if (buffers_.size() < numThreads) {
+        buffers_.resize(numThreads);
+    }
+    std::vector<int> results(count, NFLC_OK);
+
+    bool trusted = trusted_;
+    NflcBlockCache* cache = cache_;
+    trusted_ = false;
+    cache_ = nullptr;
+    nflcParallelFor(count, numThreads, [&](uint32_t i, unsigned worker) {
+        std::vector<unsigned char>& buf = buffers_[worker].block;
+        growBuffer(buf, blocks_[i].uncompSize);
+        size_t outLen = 0;
+        results[i] = decodeBlock(i, buf, outLen);
+    });
+    trusted_ = trusted;
+    cache_ = cache;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (results[i] != NFLC_OK) {
+            error_ = "Block " + std::to_string(blocks_[i].slot) + " " + nflcErrorText(results[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NflcReader::readRange(uint64_t offset, uint32_t length, unsigned char* out, unsigned numThreads) {
+    std::memset(out, 0, length);
+    std::pair<size_t, size_t> range = findBlocks(offset, length);
+    uint32_t count = static_cast<uint32_t>(range.second - range.first);
+
+    numThreads = std::min<unsigned>(numThreads, std::max<uint32_t>(count, 1));
+    if (buffers_.size() < numThreads) {
+        buffers_.resize(numThreads);
+    }
+    std::vector<int> results(count, NFLC_OK);
+
+    nflcParallelFor(count, numThreads, [&](uint32_t n, unsigned worker) {
+        size_t i = range.first + n;
+        const BlockEntry& e = blocks_[i];
+        uint64_t blockStart = e.uncompOffset;
+        uint64_t blockEnd = blockStart + e.uncompSize;
+        uint64_t copyStart = std::max(blockStart, offset);
+        uint64_t copyEnd = std::min(blockEnd, offset + length);
+        size_t outLen = 0;
+
+        if (copyStart == blockStart && copyEnd == blockEnd) {
+            results[n] = decodeBlock(i, std::span<unsigned char>(out + (blockStart - offset), e.uncompSize), outLen);
+            return;
+        }
+
+        std::vector<unsigned char>& buf = buffers_[worker].block;
+        growBuffer(buf, e.uncompSize);
+        results[n] = decodeBlock(i, buf, outLen);
+        if (results[n] == NFLC_OK && copyEnd > copyStart) {
+            uint64_t available = std::min<uint64_t>(blockStart + outLen, copyEnd);
+            if (available > copyStart) {
+                std::memcpy(out + (copyStart - offset), buf.data() + (copyStart - blockStart),
+                    static_cast<size_t>(available - copyStart));
+            }
+        }
+    });
+
+    for (uint32_t n = 0; n < count; n++) {
+        if (results[n] != NFLC_OK) {
+            error_ = "Block " + std::to_string(blocks_[range.first + n].slot) + " " + nflcErrorText(results[n]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void NflcPayloadArena::reset(size_t inputSize, uint32_t regionSize, uint32_t maxChunk) {
+    // Every block but a region's last is at least this long, which bounds the block count
+    uint32_t minBlock = std::max<uint32_t>(std::min(ALWAYS_FITS_CHUNK, maxChunk), 1);
+    size_t regionLen = std::min<size_t>(regionSize, inputSize);
+    size_t maxBlocks = regionLen / minBlock + 1;
+    stride_ = regionLen + regionLen / 16 + maxBlocks * lzoWorstCase(0);
+
+    size_t numRegions = (inputSize + regionSize - 1) / regionSize;
+    size_t needed = numRegions * stride_;
+    if (needed > capacity_) {
+        data_.reset(new unsigned char[needed]);
+        capacity_ = needed;
+    }
+}
+
+int nflcPackRegion(const unsigned char* src, uint32_t length, uint32_t maxChunk, int level, NflcWorkerBuffers& buffers,
+    unsigned char* stripe, size_t stripeCapacity, std::vector<NflcChunk>& out, bool split) {
+    uint32_t lastGuess = maxChunk;
+    size_t used = 0;
+    // Shorter cuts stay at or above the arena's per-block bound
+    uint32_t minCut = std::min(ALWAYS_FITS_CHUNK, maxChunk);
+
+    uint32_t pos = 0;
+    while (pos < length) {
+        if (g_progress.cancelled()) {
+            return NFLC_E_CANCELLED;
+        }
+        uint32_t limit = std::min(maxChunk, length - pos);
+        uint32_t fitLen = 0;
+        uint32_t fitComp = 0;
+        int result = fitBlock(src + pos, limit, level, lastGuess, buffers, fitLen, fitComp);
+        if (result != NFLC_OK) {
+            return result;
+        }
+        if (fitLen == 0) {
+            return LZO_E_ERROR;
+        }
+
+        if (used + fitComp > stripeCapacity) {
+            return LZO_E_OUTPUT_OVERRUN;
+        }
+        std::memcpy(stripe + used, buffers.best.data(), fitComp);
+
+        if (split && pos + fitLen < length) {
+            // Fit the next block from each candidate end (this reuses best, whose payload is
+            // already in the stripe) and keep the end it reaches furthest from
+            uint32_t step = std::max<uint32_t>(fitLen / SPLIT_STEP_DIVISOR, 1);
+            uint32_t cut = fitLen;
+            uint64_t reach = 0;
+            for (uint32_t k = 0; k < SPLIT_CANDIDATES && static_cast<uint64_t>(k) * step < fitLen; k++) {
+                uint32_t end = fitLen - k * step;
+                if (k > 0 && end < minCut) {
+                    break;
+                }
+                uint32_t nextLen = 0;
+                uint32_t nextComp = 0;
+                result = fitBlock(src + pos + end, std::min(maxChunk, length - pos - end), level, fitLen, buffers,
+                    nextLen, nextComp);
+                if (result != NFLC_OK) {
+                    return result;
+                }
+                if (end + nextLen > reach) {
+                    reach = end + nextLen;
+                    cut = end;
+                }
+            }
+            if (cut != fitLen) {
+                result = fitBlock(src + pos, cut, level, cut, buffers, fitLen, fitComp);
+                if (result != NFLC_OK) {
+                    return result;
+                }
+                if (fitLen == 0) {
+                    return LZO_E_ERROR;
+                }
+                if (used + fitComp > stripeCapacity) {
+                    return LZO_E_OUTPUT_OVERRUN;
+                }
+                std::memcpy(stripe + used, buffers.best.data(), fitComp);
+            }
+        }
+
+        NflcChunk ci;
+        ci.compData = stripe + used;
+        ci.uncompSize = fitLen;
+        ci.compSize = fitComp;
+        ci.srcData = src + pos;
+        {
+            NflcStageTimer timer(NflcStage::Checksum);
+            ci.payloadCrc = crc32c(ci.compData, fitComp);
+            ci.dataCrc = crc32c(src + pos, fitLen);
+        }
+        out.push_back(ci);
+
+        g_progress.advance(fitLen);
+
+        used += fitComp;
+        lastGuess = fitLen;
+        pos += fitLen;
+    }
+    return NFLC_OK;
+}
+
+uint32_t nflcRegionSize(const NflcCompressOptions& opts) {
+    return opts.pack ? NFLC_PACK_REGION_SIZE : NFLC_TARGET_CHUNK;
+}
+
+int nflcPackBuffer(const unsigned char* data, size_t size, const NflcCompressOptions& opts,
+    std::vector<NflcWorkerBuffers>& buffers, NflcPayloadArena& arena, std::vector<NflcChunk>& chunks,
+    uint32_t& totalZSize, uint64_t& failOffset, std::vector<double>* taskSeconds) {
+    // Fixed 40KB chunks by default; pack works on larger regions and lets the packer
+    // choose every block's length
+    uint32_t regionSize = nflcRegionSize(opts);
+    uint32_t maxChunk = opts.pack ? std::max<uint32_t>(opts.maxChunk, 1) : NFLC_TARGET_CHUNK;
+    uint32_t numRegions = static_cast<uint32_t>((size + regionSize - 1) / regionSize);
+    arena.reset(size, regionSize, maxChunk);
+
+    // Region boundaries are fixed up front, so workers pack them independently
+    std::vector<std::vector<NflcChunk>> regions(numRegions);
+    std::vector<int> regionResults(numRegions, NFLC_OK);
+    if (taskSeconds != nullptr) {
+        taskSeconds->assign(numRegions, 0.0);
+    }
+
+    nflcParallelFor(numRegions, static_cast<unsigned>(buffers.size()), [&](uint32_t i, unsigned worker) {
+        auto start = std::chrono::steady_clock::now();
+        size_t offset = static_cast<size_t>(i) * regionSize;
+        uint32_t length = static_cast<uint32_t>(std::min<size_t>(regionSize, size - offset));
+        regionResults[i] = nflcPackRegion(data + offset, length, maxChunk, opts.level, buffers[worker],
+            arena.stripe(i), arena.stripeCapacity(), regions[i], opts.split);
+        if (taskSeconds != nullptr) {
+            (*taskSeconds)[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    });
+
+    totalZSize = 0;
+    chunks.clear();
+    for (uint32_t i = 0; i < numRegions; i++) {
+        if (regionResults[i] != NFLC_OK) {
+            failOffset = static_cast<uint64_t>(i) * regionSize;
+            return regionResults[i];
+        }
+        for (const NflcChunk& ci : regions[i]) {
+            totalZSize += ci.compSize;
+            chunks.push_back(ci);
+        }
+    }
+    return NFLC_OK;
+}
+
+int nflcPackIncremental(const unsigned char* data, size_t size, const NflcReader& base, const NflcCompressOptions& opts,
+    std::vector<NflcWorkerBuffers>& buffers, NflcPayloadArena& arena, std::vector<NflcChunk>& chunks,
+    uint32_t& totalZSize, uint64_t& failOffset, uint64_t& reusedBytes) {
+    uint32_t regionSize = nflcRegionSize(opts);
+    uint32_t maxChunk = opts.pack ? std::max<uint32_t>(opts.maxChunk, 1) : NFLC_TARGET_CHUNK;
+    uint32_t numRegions = static_cast<uint32_t>((size + regionSize - 1) / regionSize);
+    arena.reset(size, regionSize, maxChunk);
+
+    const std::vector<NflcReader::BlockEntry>& baseBlocks = base.blocks();
+    const unsigned char* baseData = base.view().data();
+    std::vector<std::vector<NflcChunk>> regions(numRegions);
+    std::vector<int> regionResults(numRegions, NFLC_OK);
+    std::vector<uint64_t> regionReused(numRegions, 0);
+
+    nflcParallelFor(numRegions, static_cast<unsigned>(buffers.size()), [&](uint32_t i, unsigned worker) {
+        size_t start = static_cast<size_t>(i) * regionSize;
+        size_t end = std::min<size_t>(start + regionSize, size);
+        std::vector<NflcChunk>& out = regions[i];
+
+        // A base block can be reused if it lies inside the region and still decodes to the
+        // bytes now at its offset
+        auto reusable = [&](size_t n) {
+            const NflcReader::BlockEntry& e = baseBlocks[n];
+            if (e.uncompOffset < start || e.uncompOffset >= end || e.uncompSize > end - e.uncompOffset ||
+                e.compSize > NFLC_MAX_PAYLOAD) {
+                return false;
+            }
+            const unsigned char* src = data + e.uncompOffset;
+            if (e.crc.present) {
+                NflcStageTimer timer(NflcStage::Checksum);
+                if (crc32c(src, e.uncompSize) != e.crc.data) {
+                    return false;
+                }
+            }
+            std::vector<unsigned char>& decoded = buffers[worker].block;
+            growBuffer(decoded, e.uncompSize);
+            size_t outLen = 0;
+            return base.decodeBlock(n, decoded, outLen) == NFLC_OK && outLen == e.uncompSize &&
+                std::memcmp(decoded.data(), src, outLen) == 0;
+        };
+
+        size_t pos = start;
+        size_t used = 0;    // stripe bytes taken by the packed stretches so far
+        size_t b = base.findBlocks(start, 1).first;
+        while (pos < end) {
+            // Reuse base blocks for as long as they line up with the input and still match it
+            while (b < baseBlocks.size() && baseBlocks[b].uncompOffset == pos && reusable(b)) {
+                const NflcReader::BlockEntry& e = baseBlocks[b];
+                const unsigned char* src = data + pos;
+                NflcChunk ci;
+                ci.compData = baseData + NflcCodec::payloadOffset(e.slot);
+                ci.uncompSize = e.uncompSize;
+                ci.compSize = e.compSize;
+                ci.payloadCrc = e.crc.present ? e.crc.payload : crc32c(ci.compData, ci.compSize);
+                ci.dataCrc = e.crc.present ? e.crc.data : crc32c(src, e.uncompSize);
+                ci.srcData = src;
+                out.push_back(ci);
+                g_stats.count(NflcCounter::ReusedBlocks);
+                g_progress.advance(e.uncompSize);
+                regionReused[i] += e.uncompSize;
+                pos += e.uncompSize;
+                b++;
+            }
+            if (pos >= end) {
+                break;
+            }
+
+            // Changed input: pack it up to the next base block that still matches where it
+            // stands and resume reusing there, so one edit costs only the blocks around it.
+            // Blocks shorter than an empty stream's worst case are not worth resyncing on and
+            // could outgrow the stripe.
+            while (b < baseBlocks.size() && baseBlocks[b].uncompOffset <= pos) {
+                b++;
+            }
+            size_t resync = end;
+            for (; b < baseBlocks.size() && baseBlocks[b].uncompOffset < end; b++) {
+                if (baseBlocks[b].uncompSize >= lzoWorstCase(0) && reusable(b)) {
+                    resync = baseBlocks[b].uncompOffset;
+                    break;
+                }
+            }
+            size_t first = out.size();
+            regionResults[i] = nflcPackRegion(data + pos, static_cast<uint32_t>(resync - pos), maxChunk, opts.level,
+                buffers[worker], arena.stripe(i) + used, arena.stripeCapacity() - used, out, opts.split);
+            if (regionResults[i] != NFLC_OK) {
+                return;
+            }
+            for (size_t k = first; k < out.size(); k++) {
+                used += out[k].compSize;
+            }
+            pos = resync;
+        }
+    });
+
+    totalZSize = 0;
+    reusedBytes = 0;
+    chunks.clear();
+    for (uint32_t i = 0; i < numRegions; i++) {
+        if (regionResults[i] != NFLC_OK) {
+            failOffset = static_cast<uint64_t>(i) * regionSize;
+            return regionResults[i];
+        }
+        reusedBytes += regionReused[i];
+        for (const NflcChunk& ci : regions[i]) {
+            totalZSize += ci.compSize;
+            chunks.push_back(ci);
+        }
+    }
+    return NFLC_OK;
+}
+
+bool NflcMemorySink::write(const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    data_.insert(data_.end(), p, p + len);
+    return true;
+}
+
+bool NflcMemorySink::writeAt(uint64_t offset, const void* data, size_t len) {
+    if (offset > data_.size() || len > data_.size() - offset) {
+        return false;
+    }
+    std::memcpy(data_.data() + offset, data, len);
+    return true;
+}
+
+bool NflcMemorySink::reserve(uint64_t bytes) {
+    data_.reserve(data_.size() + static_cast<size_t>(bytes));
+    return true;
+}
+
+NflcFileSink::AlignedBuffer NflcFileSink::allocate(size_t size) {
+    return AlignedBuffer(new (std::align_val_t(ALIGNMENT)) unsigned char[size]);
+}
+
+bool NflcFileSink::open(const std::string& path, bool direct, size_t bufferSize) {
+    close();
+    size_ = reserved_ = bufferOffset_ = 0;
+    used_ = 0;
+    bufferSize_ = std::max<size_t>((bufferSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1), ALIGNMENT);
+    buffer_ = allocate(bufferSize_);
+    direct_ = direct;
+    path_ = path;
+#ifdef _WIN32
+    // Read access too, for the read-modify-write of writeAt() in direct mode; shared so
+    // leaveDirectMode() can reopen the file
+    DWORD flags = direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+    handle_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        CREATE_ALWAYS, flags, nullptr);
+    ok_ = handle_ != INVALID_HANDLE_VALUE;
+#else
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct) {
+        fd_ = ::open(path.c_str(), flags | O_DIRECT, 0666);
+    }
+#endif
+    if (fd_ < 0) {
+        // No O_DIRECT here, or the file system refuses it
+        fd_ = ::open(path.c_str(), flags, 0666);
+#ifdef F_NOCACHE
+        direct_ = direct && fd_ >= 0 && fcntl(fd_, F_NOCACHE, 1) == 0;
+#else
+        direct_ = false;
+#endif
+    }
+    ok_ = fd_ >= 0;
+#endif
+    return ok_;
+}
+
+bool NflcFileSink::close() {
+#ifdef _WIN32
+    if (handle_ == INVALID_HANDLE_VALUE) {
+        return ok_;
+    }
+#else
+    if (fd_ < 0) {
+        return ok_;
+    }
+#endif
+    uint64_t written = bufferOffset_ + used_;
+    if (!flushBuffer(true)) {
+        ok_ = false;
+    }
+    // Direct writes were padded to whole pages, and reserve() may have allocated more than was written
+    if (ok_ && (bufferOffset_ > written || reserved_ > written) && !truncateFile(written)) {
+        ok_ = false;
+    }
+#ifdef _WIN32
+    if (!CloseHandle(handle_)) {
+        ok_ = false;
+    }
+    handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (::close(fd_) != 0) {
+        ok_ = false;
+    }
+    fd_ = -1;
+#endif
+    buffer_.reset();
+    return ok_;
+}
+
+void NflcFileSink::discard() {
+#ifdef _WIN32
+    if (handle_ == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (fd_ < 0) {
+        return;
+    }
+    ::close(fd_);
+    fd_ = -1;
+#endif
+    buffer_.reset();
+    std::error_code ec;
+    std::filesystem::remove(path_, ec);
+}
+
+bool NflcFileSink::write(const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    size_ += len;
+    while (len > 0 && ok_) {
+        // Large writes that start a buffer go straight out, in whole pages, so bufferOffset_
+        // stays aligned until close()
+        size_t pages = len & ~(ALIGNMENT - 1);
+        bool aligned = !direct_ || (reinterpret_cast<uintptr_t>(p) & (ALIGNMENT - 1)) == 0;
+        if (used_ == 0 && len >= bufferSize_ && aligned) {
+            ok_ = writeFile(bufferOffset_, p, pages);
+            bufferOffset_ += pages;
+            p += pages;
+            len -= pages;
+            continue;
+        }
+        size_t n = std::min(len, bufferSize_ - used_);
+        std::memcpy(buffer_.get() + used_, p, n);
+        used_ += n;
+        p += n;
+        len -= n;
+        if (used_ == bufferSize_) {
+            ok_ = flushBuffer(false);
+        }
+    }
+    return ok_;
+}
+
+bool NflcFileSink::flushBuffer(bool final) {
+    if (used_ == 0 || buffer_ == nullptr) {
+        return ok_;
+    }
+    size_t len = used_;
+    if (final && direct_) {
+        // Direct writes cover whole pages; close() trims the zeros again
+        len = (used_ + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        std::memset(buffer_.get() + used_, 0, len - used_);
+    }
+    ok_ = ok_ && writeFile(bufferOffset_, buffer_.get(), len);
+    bufferOffset_ += len;
+    used_ = 0;
+    return ok_;
+}
+
+bool NflcFileSink::writeAt(uint64_t offset, const void* data, size_t len) {
+    if (!ok_ || offset > size_ || len > size_ - offset) {
+        ok_ = false;
+        return false;
+    }
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+
+    // The part still in the buffer is patched there
+    if (offset + len > bufferOffset_) {
+        uint64_t start = std::max(offset, bufferOffset_);
+        std::memcpy(buffer_.get() + (start - bufferOffset_), p + (start - offset), static_cast<size_t>(offset + len - start));
+        len = static_cast<size_t>(start - offset);
+    }
+    if (len == 0) {
+        return true;
+    }
+    if (!direct_) {
+        ok_ = writeFile(offset, p, len);
+        return ok_;
+    }
+
+    // Direct mode only moves whole pages; everything before bufferOffset_ was written as such
+    uint64_t first = offset & ~static_cast<uint64_t>(ALIGNMENT - 1);
+    size_t span = static_cast<size_t>(((offset + len + ALIGNMENT - 1) & ~static_cast<uint64_t>(ALIGNMENT - 1)) - first);
+    AlignedBuffer pages = allocate(span);
+    ok_ = readFile(first, pages.get(), span);
+    if (ok_) {
+        std::memcpy(pages.get() + (offset - first), p, len);
+        ok_ = writeFile(first, pages.get(), span);
+    }
+    return ok_;
+}
+
+bool NflcFileSink::reserve(uint64_t bytes) {
+    uint64_t end = size_ + bytes;
+    if (!ok_ || end <= reserved_) {
+        return ok_;
+    }
+#ifdef _WIN32
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(end);
+    if (!SetFileInformationByHandle(handle_, FileAllocationInfo, &info, sizeof(info))) {
+        // Preallocation is only a hint, unless the disk is full
+        return GetLastError() != ERROR_DISK_FULL;
+    }
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(end - reserved_), 0 };
+    if (fcntl(fd_, F_PREALLOCATE, &store) != 0) {
+        return errno != ENOSPC;
+    }
+#else
+    int result = posix_fallocate(fd_, 0, static_cast<off_t>(end));
+    if (result != 0) {
+        // Preallocation is only a hint, unless the disk is full
+        return result != ENOSPC;
+    }
+#endif
+    reserved_ = end;
+    return true;
+}
+
+bool NflcFileSink::writeFile(uint64_t offset, const unsigned char* data, size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        OVERLAPPED position = {};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD n = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(len, 1u << 30));
+        if (!WriteFile(handle_, data, chunk, &n, &position) || n == 0) {
+            if (direct_ && GetLastError() == ERROR_INVALID_PARAMETER) {
+                leaveDirectMode();
+                continue;
+            }
+            return false;
+        }
+#else
+        ssize_t n = pwrite(fd_, data, len, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && direct_) {
+            // The file system took O_DIRECT at open but not for this write
+            leaveDirectMode();
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+#endif
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool NflcFileSink::readFile(uint64_t offset, unsigned char* data, size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        OVERLAPPED position = {};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD n = 0;
+        if (!ReadFile(handle_, data, static_cast<DWORD>(std::min<size_t>(len, 1u << 30)), &n, &position) || n == 0) {
+            return false;
+        }
+#else
+        ssize_t n = pread(fd_, data, len, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+#endif
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool NflcFileSink::truncateFile(uint64_t size) {
+#ifdef _WIN32
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    return SetFileInformationByHandle(handle_, FileEndOfFileInfo, &info, sizeof(info)) != 0;
+#else
+    return ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+void NflcFileSink::leaveDirectMode() {
+    direct_ = false;
+#ifdef _WIN32
+    HANDLE buffered = ReOpenFile(handle_, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        FILE_ATTRIBUTE_NORMAL);
+    if (buffered != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle_);
+        handle_ = buffered;
+    }
+#else
+#ifdef O_DIRECT
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+#endif
+#endif
+}
+
+NflcBlockVerifier::NflcBlockVerifier(unsigned numThreads) {
+    for (unsigned i = 0; i < std::max(numThreads, 1u); i++) {
+        threads_.emplace_back([this] { run(); });
+    }
+}
+
+NflcBlockVerifier::~NflcBlockVerifier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    ready_.notify_all();
+    for (std::thread& t : threads_) {
+        t.join();
+    }
+}
+
+void NflcBlockVerifier::beginArchive(NflcByteSpan source) {
+    uncompOffset_ = 0;
+    source_ = source;
+    sourceStart_ = 0;
+}
+
+void NflcBlockVerifier::addSource(NflcByteSpan source) {
+    sourceStart_ += source_.size();
+    source_ = source;
+}
+
+void NflcBlockVerifier::submit(uint32_t blockIndex, std::vector<unsigned char> written, const NflcChunk& chunk) {
+    Job job;
+    job.blockIndex = blockIndex;
+    job.written = std::move(written);
+    job.chunk = chunk;
+    job.uncompOffset = uncompOffset_;
+    // Batches hold whole blocks, so a block's input is always in one piece of source
+    bool inSource = uncompOffset_ >= sourceStart_ && uncompOffset_ - sourceStart_ <= source_.size() &&
+        chunk.uncompSize <= source_.size() - (uncompOffset_ - sourceStart_);
+    job.source = inSource ? source_.data() + (uncompOffset_ - sourceStart_) : nullptr;
+    uncompOffset_ += chunk.uncompSize;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+    }
+    ready_.notify_one();
+}
+
+bool NflcBlockVerifier::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return queue_.empty() && busy_ == 0; });
+    return !failed();
+}
+
+std::string NflcBlockVerifier::error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+void NflcBlockVerifier::run() {
+    std::vector<unsigned char> buf;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        ready_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        busy_++;
+
+        // Once a block has failed the rest are only drained
+        std::string problem;
+        if (!failed()) {
+            lock.unlock();
+            problem = check(job, buf);
+            lock.lock();
+        }
+        if (!problem.empty()) {
+            // Report the earliest failing block when several fail at once
+            if (!failed() || job.blockIndex < errorBlock_) {
+                errorBlock_ = job.blockIndex;
+                error_ = "block " + std::to_string(job.blockIndex) + ": " + problem;
+            }
+            failed_.store(true, std::memory_order_relaxed);
+        }
+        else {
+            verified_.fetch_add(1, std::memory_order_relaxed);
+        }
+        busy_--;
+        if (queue_.empty() && busy_ == 0) {
+            idle_.notify_all();
+        }
+    }
+}
+
+std::string NflcBlockVerifier::check(const Job& job, std::vector<unsigned char>& buf) const {
+    // The header and payload as a reader will see them
+    NflcBlockHeader hdr;
+    if (job.written.size() < NFLC_HEADER_SIZE || !NflcCodec::loadHeader(job.written.data(), hdr)) {
+        return "header does not parse";
+    }
+    const unsigned char* payload = job.written.data() + NFLC_HEADER_SIZE;
+    size_t payloadSize = job.written.size() - NFLC_HEADER_SIZE;
+    const NflcChunk& ci = job.chunk;
+    if (hdr.zsize != payloadSize) {
+        return "zsize is " + std::to_string(hdr.zsize) + " but " + std::to_string(payloadSize) +
+            " payload bytes were written";
+    }
+    if (hdr.prevUncompOffset != job.uncompOffset) {
+        return "prevUncompOffset is " + std::to_string(hdr.prevUncompOffset) + ", expected " +
+            std::to_string(job.uncompOffset);
+    }
+    if (hdr.blockUncompSize != ci.uncompSize) {
+        return "blockUncompSize is " + std::to_string(hdr.blockUncompSize) + " but the block packs " +
+            std::to_string(ci.uncompSize) + " bytes";
+    }
+    if (job.source == nullptr) {
+        return "input [" + std::to_string(job.uncompOffset) + ", " + std::to_string(job.uncompOffset + ci.uncompSize) +
+            ") lies past the end of the source";
+    }
+    if (ci.srcData != nullptr && ci.srcData != job.source) {
+        return "packed from the wrong input, expected the input at " + std::to_string(job.uncompOffset);
+    }
+    NflcBlockCrc crc = nflcBlockCrc(hdr);
+    if (crc.present && crc32c(payload, payloadSize) != crc.payload) {
+        return "payload CRC does not match";
+    }
+
+    // Always the checked LZO1X decoder, stored blocks included
+    growBuffer(buf, hdr.blockUncompSize);
+    size_t outLen = hdr.blockUncompSize;
+    int result = lzo1xDecompressFast(payload, payloadSize, buf.data(), outLen);
+    if (result != NFLC_OK) {
+        return nflcErrorText(result);
+    }
+    if (outLen != hdr.blockUncompSize) {
+        return "decoded " + std::to_string(outLen) + " bytes, expected " + std::to_string(hdr.blockUncompSize);
+    }
+    if (crc.present && crc32c(buf.data(), outLen) != crc.data) {
+        return "data CRC does not match";
+    }
+    if (std::memcmp(buf.data(), job.source, outLen) != 0) {
+        return "decoded data differs from the input";
+    }
+    return std::string();
+}
+
+bool NflcBlockWriter::append(const NflcChunk& ci) {
+    if (ci.compSize > NFLC_MAX_PAYLOAD || (verifier_ != nullptr && verifier_->failed())) {
+        return false;
+    }
+    if (blocks_ > 0) {
+        // Pad the previous slot out to the 32KB boundary
+        NflcStageTimer timer(NflcStage::Padding);
+        static const unsigned char zeroPadding[NFLC_BLOCK_SIZE] = {};
+        uint64_t blockEnd = static_cast<uint64_t>(blocks_) * NFLC_BLOCK_SIZE;
+        uint64_t paddingSize = blockEnd - position_;
+        if (!sink_.write(zeroPadding, static_cast<size_t>(paddingSize))) {
+            return false;
+        }
+        position_ = blockEnd;
+        g_stats.count(NflcCounter::PaddingBytes, paddingSize);
+    }
+
+    // Prepare block header
+    NflcBlockHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+
+    std::memcpy(hdr.magic, "nFlC", 4);
+    hdr.version = 0x0101;
+    hdr.blockIndex = static_cast<uint16_t>(blocks_);
+    hdr.flags = 0x80000012;
+    hdr.flags2 = 0x80000080;
+    hdr.dummy1 = 0x0901;
+    hdr.zsize = static_cast<uint16_t>(ci.compSize);
+    hdr.checksum1 = 0xCB3E47E2;  // Same in every block; not a content checksum
+    hdr.blockUncompSize = ci.uncompSize;
+    hdr.checksum2 = 0xA309C008;
+    hdr.totalZSize = totalZSize_;
+    hdr.prevZOffset = static_cast<uint32_t>(prevZOffset_);
+    hdr.totalUncompSize = totalUncompSize_;
+    hdr.prevUncompOffset = static_cast<uint32_t>(prevUncompOffset_);
+    hdr.crcTag = NFLC_CRC_TAG;
+    hdr.payloadCrc = ci.payloadCrc;
+    hdr.dataCrc = ci.dataCrc;
+
+    {
+        NflcStageTimer timer(NflcStage::OutputWrite);
+
+        // Header, then the compressed data
+        unsigned char hdrBytes[NflcCodec::HEADER_SIZE];
+        NflcCodec::storeHeader(hdr, hdrBytes);
+        if (verifier_ != nullptr) {
+            // Serialise the slot once, so the verifier checks exactly the bytes the sink got
+            std::vector<unsigned char> written(sizeof(hdrBytes) + ci.compSize);
+            std::memcpy(written.data(), hdrBytes, sizeof(hdrBytes));
+            std::memcpy(written.data() + sizeof(hdrBytes), ci.compData, ci.compSize);
+            if (!sink_.write(written.data(), written.size())) {
+                return false;
+            }
+            verifier_->submit(blocks_, std::move(written), ci);
+        }
+        else if (!sink_.write(hdrBytes, sizeof(hdrBytes)) || !sink_.write(ci.compData, ci.compSize)) {
+            return false;
+        }
+    }
+    position_ += NFLC_HEADER_SIZE + ci.compSize;
+
+    g_stats.count(NflcCounter::Blocks);
+    g_stats.count(NflcCounter::BytesIn, ci.uncompSize);
+    g_stats.count(NflcCounter::BytesOut, ci.compSize);
+
+    // Track cumulative offsets
+    prevZOffset_ += ci.compSize;
+    prevUncompOffset_ += ci.uncompSize;
+    blocks_++;
+    return true;
+}
+
+bool NflcBlockWriter::patchTotals(uint32_t totalZSize, uint32_t totalUncompSize) {
+    NflcStageTimer timer(NflcStage::OutputWrite);
+    unsigned char zBytes[4];
+    unsigned char uncompBytes[4];
+    NflcCodec::store(zBytes, totalZSize);
+    NflcCodec::store(uncompBytes, totalUncompSize);
+    for (uint32_t i = 0; i < blocks_; i++) {
+        uint64_t base = NflcCodec::slotOffset(i);
+        if (!sink_.writeAt(base + offsetof(NflcBlockHeader, totalZSize), zBytes, sizeof(zBytes)) ||
+            !sink_.writeAt(base + offsetof(NflcBlockHeader, totalUncompSize), uncompBytes, sizeof(uncompBytes))) {
+            return false;
+        }
+    }
+    totalZSize_ = totalZSize;
+    totalUncompSize_ = totalUncompSize;
+    return true;
+}
+
+bool nflcWriteBlocks(NflcSink& sink, const std::vector<NflcChunk>& chunks, uint32_t totalZSize, uint32_t totalUncompSize,
+    NflcBlockVerifier* verifier) {
+    if (!chunks.empty() && !sink.reserve(static_cast<uint64_t>(chunks.size() - 1) * NFLC_BLOCK_SIZE +
+        NFLC_HEADER_SIZE + chunks.back().compSize)) {
+        return false;
+    }
+    NflcBlockWriter writer(sink, totalZSize, totalUncompSize, verifier);
+    for (const NflcChunk& ci : chunks) {
+        if (!writer.append(ci)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+NflcWriter::NflcWriter(NflcSink& sink, const NflcCompressOptions& opts, unsigned numThreads)
+    : opts_(opts), verifier_(opts.verify ? std::make_unique<NflcBlockVerifier>(numThreads) : nullptr),
+      writer_(sink, 0, 0, verifier_.get()), buffers_(nflcMakeWorkerBuffers(numThreads, true)) {
+    // Batches are whole regions so the block layout does not depend on the batch size
+    uint32_t regionSize = nflcRegionSize(opts_);
+    size_t batchRegions = std::max<size_t>(buffers_.size() * 2, STREAM_BATCH_BYTES / regionSize);
+    batch_.resize(batchRegions * regionSize);
+    if (verifier_) {
+        spareBatch_.resize(batch_.size());
+        verifier_->beginArchive(NflcByteSpan());
+    }
+}
+
+bool NflcWriter::append(NflcByteSpan data) {
+    if (!error_.empty()) {
+        return false;
+    }
+    if (finished_) {
+        error_ = "Data appended after finish()";
+        return false;
+    }
+    while (!data.empty()) {
+        size_t n = std::min(data.size(), batch_.size() - fill_);
+        if (inputSize() + n > UINT32_MAX) {
+            error_ = "Input exceeds the 4GB limit of the NFLC format";
+            return false;
+        }
+        std::memcpy(batch_.data() + fill_, data.data(), n);
+        fill_ += n;
+        data = data.subspan(n);
+        if (fill_ == batch_.size() && !flush()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NflcWriter::flush() {
+    if (fill_ == 0) {
+        return true;
+    }
+    uint32_t batchZSize = 0;
+    uint64_t failOffset = 0;
+    int result = nflcPackBuffer(batch_.data(), fill_, opts_, buffers_, arena_, chunks_, batchZSize, failOffset);
+    if (result != NFLC_OK) {
+        error_ = result == NFLC_E_CANCELLED ? std::string("Cancelled")
+                                             : "Compression failed at offset " + std::to_string(inputSize_ + failOffset);
+        return false;
+    }
+    // The previous batch was checked while this one was packed; its input is reused next
+    if (verifier_ && !verifier_->drain()) {
+        error_ = "Verification failed at " + verifier_->error();
+        return false;
+    }
+    if (verifier_) {
+        verifier_->addSource(NflcByteSpan(batch_.data(), fill_));
+    }
+    for (const NflcChunk& ci : chunks_) {
+        if (!writer_.append(ci)) {
+            error_ = verifier_ && verifier_->failed() ? "Verification failed at " + verifier_->error()
+                                                      : "Failed writing output";
+            return false;
+        }
+        if (onBlock_) {
+            onBlock_(writer_.blocks() - 1, ci);
+        }
+    }
+    if (verifier_) {
+        std::swap(batch_, spareBatch_);
+    }
+    inputSize_ += fill_;
+    fill_ = 0;
+    return true;
+}
+
+bool NflcWriter::finish() {
+    if (!error_.empty() || finished_) {
+        return error_.empty();
+    }
+    finished_ = true;
+    if (!flush()) {
+        return false;
+    }
+    if (verifier_ && !verifier_->drain()) {
+        error_ = "Verification failed at " + verifier_->error();
+        return false;
+    }
+    if (!writer_.patchTotals(static_cast<uint32_t>(writer_.zSize()), static_cast<uint32_t>(inputSize_))) {
+        error_ = "Failed updating block headers";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+// Calls fn(field, offset) for every numeric pack table field, as NflcBlockCodec::forEachField
+// does for block headers
+template <class Header, class Fn>
+void forEachPackField(Header& h, Fn&& fn) {
+    fn(h.version, offsetof(NflcPackHeader, version));
+    fn(h.memberCount, offsetof(NflcPackHeader, memberCount));
+    fn(h.tableSize, offsetof(NflcPackHeader, tableSize));
+    fn(h.dataSlot, offsetof(NflcPackHeader, dataSlot));
+    fn(h.hotSlots, offsetof(NflcPackHeader, hotSlots));
+    fn(h.reserved[0], offsetof(NflcPackHeader, reserved));
+    fn(h.reserved[1], offsetof(NflcPackHeader, reserved) + sizeof(h.reserved[0]));
+}
+
+template <class Entry, class Fn>
+void forEachEntryField(Entry& e, Fn&& fn) {
+    fn(e.firstSlot, offsetof(NflcPackEntry, firstSlot));
+    fn(e.slotCount, offsetof(NflcPackEntry, slotCount));
+    fn(e.size, offsetof(NflcPackEntry, size));
+    fn(e.uncompSize, offsetof(NflcPackEntry, uncompSize));
+    fn(e.flags, offsetof(NflcPackEntry, flags));
+    fn(e.nameOffset, offsetof(NflcPackEntry, nameOffset));
+    fn(e.nameLength, offsetof(NflcPackEntry, nameLength));
+}
+
+void loadPackHeader(const unsigned char* p, NflcPackHeader& hdr) {
+    std::memcpy(hdr.magic, p, sizeof(hdr.magic));
+    forEachPackField(hdr, [p](auto& field, size_t offset) {
+        field = NflcCodec::load<std::remove_reference_t<decltype(field)>>(p + offset);
+    });
+}
+
+void storePackHeader(const NflcPackHeader& hdr, unsigned char* p) {
+    std::memcpy(p, hdr.magic, sizeof(hdr.magic));
+    forEachPackField(hdr, [p](const auto& field, size_t offset) { NflcCodec::store(p + offset, field); });
+}
+
+void loadPackEntry(const unsigned char* p, NflcPackEntry& entry) {
+    forEachEntryField(entry, [p](auto& field, size_t offset) {
+        field = NflcCodec::load<std::remove_reference_t<decltype(field)>>(p + offset);
+    });
+}
+
+void storePackEntry(const NflcPackEntry& entry, unsigned char* p) {
+    forEachEntryField(entry, [p](const auto& field, size_t offset) { NflcCodec::store(p + offset, field); });
+}
+
+}  // namespace
+
+bool nflcIsPack(NflcByteSpan in) {
+    return in.size() >= sizeof(NflcPackHeader) && std::memcmp(in.data(), "nFlP", 4) == 0;
+}
+
+bool nflcWritePack(NflcSink& sink, const std::vector<NflcPackInput>& members, const NflcCompressOptions& opts,
+    unsigned numThreads, std::string& error) {
+    uint32_t regionSize = nflcRegionSize(opts);
+    uint32_t maxChunk = opts.pack ? std::max<uint32_t>(opts.maxChunk, 1) : NFLC_TARGET_CHUNK;
+
+    // Hot members first, otherwise in the order given
+    std::vector<size_t> order(members.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_partition(order.begin(), order.end(), [&](size_t i) { return members[i].hot; });
+
+    // One task per region of every member, all on the same workers
+    std::vector<NflcPayloadArena> arenas(members.size());
+    std::vector<uint32_t> taskStarts(members.size());
+    uint32_t totalTasks = 0;
+    for (size_t m = 0; m < members.size(); m++) {
+        size_t size = members[m].data.size();
+        if (size > UINT32_MAX) {
+            error = "Member too large for an NFLC archive: " + members[m].name;
+            return false;
+        }
+        arenas[m].reset(size, regionSize, maxChunk);
+        taskStarts[m] = totalTasks;
+        totalTasks += static_cast<uint32_t>((size + regionSize - 1) / regionSize);
+    }
+
+    std::vector<std::vector<NflcChunk>> regions(totalTasks);
+    std::vector<int> results(totalTasks, NFLC_OK);
+    std::vector<NflcWorkerBuffers> buffers = nflcMakeWorkerBuffers(std::max(numThreads, 1u), true);
+    nflcParallelFor(totalTasks, static_cast<unsigned>(buffers.size()), [&](uint32_t t, unsigned worker) {
+        // Empty members share their start with the next one; take the last member starting at or before t
+        size_t m = static_cast<size_t>(std::upper_bound(taskStarts.begin(), taskStarts.end(), t) - taskStarts.begin()) - 1;
+        uint32_t region = t - taskStarts[m];
+        NflcByteSpan data = members[m].data;
+        size_t offset = static_cast<size_t>(region) * regionSize;
+        uint32_t length = static_cast<uint32_t>(std::min<size_t>(regionSize, data.size() - offset));
+        results[t] = nflcPackRegion(data.data() + offset, length, maxChunk, opts.level, buffers[worker],
+            arenas[m].stripe(region), arenas[m].stripeCapacity(), regions[t], opts.split);
+    });
+
+    // Lay out the table, then each member from the next free slot
+    uint32_t tableSize = static_cast<uint32_t>(sizeof(NflcPackHeader) + members.size() * sizeof(NflcPackEntry));
+    std::vector<NflcPackEntry> entries(members.size());
+    for (size_t m = 0; m < members.size(); m++) {
+        entries[m].nameOffset = tableSize;
+        entries[m].nameLength = static_cast<uint32_t>(members[m].name.size());
+        tableSize += entries[m].nameLength;
+    }
+
+    NflcPackHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, "nFlP", 4);
+    hdr.version = NFLC_PACK_VERSION;
+    hdr.memberCount = static_cast<uint32_t>(members.size());
+    hdr.tableSize = tableSize;
+    hdr.dataSlot = nflcBlockCount(tableSize);
+
+    std::vector<std::vector<NflcChunk>> memberChunks(members.size());
+    std::vector<uint32_t> memberZSize(members.size(), 0);
+    uint32_t nextSlot = hdr.dataSlot;
+    for (size_t m : order) {
+        uint32_t end = m + 1 < members.size() ? taskStarts[m + 1] : totalTasks;
+        for (uint32_t t = taskStarts[m]; t < end; t++) {
+            if (results[t] == NFLC_E_CANCELLED) {
+                error = "Cancelled";
+                return false;
+            }
+            if (results[t] != NFLC_OK) {
+                error = "Compression of " + members[m].name + " failed at offset " +
+                    std::to_string(static_cast<uint64_t>(t - taskStarts[m]) * regionSize);
+                return false;
+            }
+            for (const NflcChunk& ci : regions[t]) {
+                memberZSize[m] += ci.compSize;
+                memberChunks[m].push_back(ci);
+            }
+        }
+        // Empty members have no slots; point them at the data start, which is inside the file
+        NflcPackEntry& entry = entries[m];
+        entry.firstSlot = memberChunks[m].empty() ? hdr.dataSlot : nextSlot;
+        entry.slotCount = static_cast<uint32_t>(memberChunks[m].size());
+        entry.size = entry.slotCount == 0 ? 0 : static_cast<uint64_t>(entry.slotCount - 1) * NFLC_BLOCK_SIZE +
+            NFLC_HEADER_SIZE + memberChunks[m].back().compSize;
+        entry.uncompSize = static_cast<uint32_t>(members[m].data.size());
+        entry.flags = members[m].hot ? NFLC_PACK_HOT : 0;
+        nextSlot += entry.slotCount;
+        if (members[m].hot) {
+            hdr.hotSlots += entry.slotCount;
+        }
+    }
+
+    uint64_t packSize = static_cast<uint64_t>(hdr.dataSlot) * NFLC_BLOCK_SIZE;
+    for (const NflcPackEntry& entry : entries) {
+        if (entry.size > 0) {
+            packSize = std::max<uint64_t>(packSize, static_cast<uint64_t>(entry.firstSlot) * NFLC_BLOCK_SIZE + entry.size);
+        }
+    }
+
+    // The table, padded out to dataSlot
+    uint64_t position = static_cast<uint64_t>(hdr.dataSlot) * NFLC_BLOCK_SIZE;
+    std::vector<unsigned char> table(static_cast<size_t>(position), 0);
+    storePackHeader(hdr, table.data());
+    for (size_t m = 0; m < members.size(); m++) {
+        storePackEntry(entries[m], table.data() + sizeof(NflcPackHeader) + m * sizeof(NflcPackEntry));
+        std::memcpy(table.data() + entries[m].nameOffset, members[m].name.data(), members[m].name.size());
+    }
+    static const unsigned char zeroPadding[NFLC_BLOCK_SIZE] = {};
+    bool ok = sink.reserve(packSize) && sink.write(table.data(), table.size());
+
+    std::unique_ptr<NflcBlockVerifier> verifier;
+    if (opts.verify) {
+        verifier = std::make_unique<NflcBlockVerifier>(numThreads);
+    }
+
+    for (size_t m : order) {
+        if (!ok || entries[m].slotCount == 0) {
+            continue;
+        }
+        // Pad the previous member out to its last slot
+        uint64_t start = static_cast<uint64_t>(entries[m].firstSlot) * NFLC_BLOCK_SIZE;
+        if (verifier) {
+            verifier->beginArchive(members[m].data);
+        }
+        ok = sink.write(zeroPadding, static_cast<size_t>(start - position)) &&
+            nflcWriteBlocks(sink, memberChunks[m], memberZSize[m], entries[m].uncompSize, verifier.get());
+        position = start + entries[m].size;
+        // Block numbers restart in every member, so each is settled before the next
+        if (verifier && !verifier->drain()) {
+            error = "Verification failed at " + verifier->error() + " of " + members[m].name;
+            return false;
+        }
+    }
+    if (!ok) {
+        error = "Failed writing output";
+    }
+    return ok;
+}
+
+bool NflcPackReader::open(const std::string& path) {
+    members_.clear();
+    hotOffset_ = hotSize_ = 0;
+    if (!file_.open(path)) {
+        error_ = "Cannot open input file: " + path;
+        return false;
+    }
+    data_ = file_.view();
+    return parse();
+}
+
+bool NflcPackReader::open(NflcByteSpan pack) {
+    members_.clear();
+    hotOffset_ = hotSize_ = 0;
+    file_.close();
+    data_ = pack;
+    return parse();
+}
+
+bool NflcPackReader::parse() {
+    NflcByteSpan in = data_;
+    NflcPackHeader hdr;
+    if (!nflcIsPack(in)) {
+        error_ = "Not an NFLC pack";
+        return false;
+    }
+    loadPackHeader(in.data(), hdr);
+    uint64_t entriesEnd = sizeof(hdr) + static_cast<uint64_t>(hdr.memberCount) * sizeof(NflcPackEntry);
+    if (hdr.version != NFLC_PACK_VERSION || hdr.tableSize > in.size() || entriesEnd > hdr.tableSize) {
+        error_ = "Unsupported or damaged pack table";
+        return false;
+    }
+
+    uint64_t dataStart = static_cast<uint64_t>(hdr.dataSlot) * NFLC_BLOCK_SIZE;
+    members_.reserve(hdr.memberCount);
+    for (uint32_t i = 0; i < hdr.memberCount; i++) {
+        NflcPackEntry entry;
+        loadPackEntry(in.data() + sizeof(hdr) + static_cast<size_t>(i) * sizeof(entry), entry);
+        uint64_t offset = static_cast<uint64_t>(entry.firstSlot) * NFLC_BLOCK_SIZE;
+        if (static_cast<uint64_t>(entry.nameOffset) + entry.nameLength > hdr.tableSize ||
+            offset < dataStart || offset > in.size() || entry.size > in.size() - offset) {
+            error_ = "Member " + std::to_string(i) + " lies outside the pack";
+            return false;
+        }
+        // The table's size has to agree with the member archive it describes
+        NflcBlockHeader first;
+        bool sizeOk = entry.size == 0
+            ? entry.uncompSize == 0
+            : nflcReadBlockHeader(NflcByteSpan(in.data() + offset, static_cast<size_t>(entry.size)), 0, first) &&
+              first.totalUncompSize == entry.uncompSize;
+        if (!sizeOk) {
+            error_ = "Member " + std::to_string(i) + " does not match its archive";
+            return false;
+        }
+        Member member;
+        member.name.assign(reinterpret_cast<const char*>(in.data()) + entry.nameOffset, entry.nameLength);
+        member.offset = offset;
+        member.size = entry.size;
+        member.uncompSize = entry.uncompSize;
+        member.hot = (entry.flags & NFLC_PACK_HOT) != 0;
+        members_.push_back(std::move(member));
+    }
+
+    hotOffset_ = std::min<uint64_t>(dataStart, in.size());
+    hotSize_ = std::min<uint64_t>(static_cast<uint64_t>(hdr.hotSlots) * NFLC_BLOCK_SIZE, in.size() - hotOffset_);
+    return true;
+}
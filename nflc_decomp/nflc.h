@@ -0,0 +1,1028 @@
+// libnflc: reading and writing Ultimate Spider-Man NFLC archives in process
+//
+// An archive is a sequence of 32KB slots, each holding a 64-byte NflcBlockHeader followed by
+// one LZO1X-compressed block. NflcReader indexes the headers of an archive once and decodes
+// blocks or byte ranges on demand; NflcWriter takes uncompressed data in pieces and writes a
+// complete archive to an NflcSink. The lower-level pieces they are built from (slot decoding,
+// the block packer, the serialiser) are exposed too, for callers that drive their own
+// threads. Nothing here prints or touches iostreams: results are LZO_E_* / NFLC_E_* codes
+// (NFLC_OK on success) and error() strings; progress and cancellation go through
+// nflcProgress().
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lzo1x_hc.h"
+
+// Slot layout
+constexpr uint32_t NFLC_BLOCK_SIZE = 32768;    // 32KB slots
+constexpr uint32_t NFLC_HEADER_SIZE = 64;      // 64-byte header per slot
+
+// Each slot can hold up to (NFLC_BLOCK_SIZE - NFLC_HEADER_SIZE) bytes of compressed data
+constexpr uint32_t NFLC_MAX_PAYLOAD = NFLC_BLOCK_SIZE - NFLC_HEADER_SIZE;
+static_assert(NFLC_MAX_PAYLOAD <= 0xFFFF, "zsize is a 16-bit field");
+
+// Most a payload of zsize bytes can decode to. LZO1X spends at least one byte per 255 bytes
+// of match, so a header claiming more than this is damaged or hostile.
+constexpr uint64_t nflcMaxDecodedSize(uint32_t zsize) {
+    return static_cast<uint64_t>(zsize < NFLC_MAX_PAYLOAD ? zsize : NFLC_MAX_PAYLOAD) * 256;
+}
+
+// Default block size: input chunks of ~40KB usually compress to under 32KB
+constexpr uint32_t NFLC_TARGET_CHUNK = 40960;
+
+// Packing: input is split into regions of this size that are packed independently (and in
+// parallel). Only the last block of each region can end up short, and the block layout
+// does not depend on the thread count.
+constexpr uint32_t NFLC_PACK_REGION_SIZE = 4 * 1024 * 1024;
+constexpr uint32_t NFLC_DEFAULT_MAX_CHUNK = 256 * 1024;
+
+// Compression levels: 1 is miniLZO's LZO1X-1, 2..9 the high-ratio encoder in lzo1x_hc.cpp.
+// Auto compresses every block at several levels and keeps the one that fits the most input
+// in the slot, or the smaller payload when two fit the same.
+constexpr int NFLC_LEVEL_AUTO = 0;
+constexpr int NFLC_DEFAULT_LEVEL = 1;
+
+// NFLC Block Header structure (64 bytes). Every field sits at its natural alignment, so the
+// struct needs no packing; archives are always little-endian, and headers go to and from
+// archive bytes through NflcBlockCodec::loadHeader / storeHeader.
+struct NflcBlockHeader {
+    char magic[4];              // 0x00: "nFlC"
+    uint16_t version;           // 0x04: Version (usually 0x0101)
+    uint16_t blockIndex;        // 0x06: Block index (0, 1, 2, ...)
+    uint32_t flags;             // 0x08: Flags (0x80000012 for LZO)
+    uint32_t flags2;            // 0x0C: Additional flags
+    uint16_t dummy1;            // 0x10: Unknown
+    uint16_t zsize;             // 0x12: Compressed size in this block
+    uint32_t checksum1;         // 0x14: Identifier (same in every block, not a content checksum)
+    uint32_t blockUncompSize;   // 0x18: Uncompressed size of this block
+    uint32_t checksum2;         // 0x1C: Identifier (same in every block, not a content checksum)
+    uint32_t totalZSize;        // 0x20: Total compressed size (all blocks)
+    uint32_t prevZOffset;       // 0x24: Cumulative compressed offset (previous blocks)
+    uint32_t totalUncompSize;   // 0x28: Total uncompressed size (all blocks)
+    uint32_t prevUncompOffset;  // 0x2C: Cumulative uncompressed offset (previous blocks)
+    uint32_t crcTag;            // 0x30: NFLC_CRC_TAG when the next two fields are set, else zero
+    uint32_t payloadCrc;        // 0x34: CRC-32C of the zsize compressed bytes
+    uint32_t dataCrc;           // 0x38: CRC-32C of the blockUncompSize uncompressed bytes
+    uint32_t reserved;          // 0x3C: Zero
+};
+static_assert(sizeof(NflcBlockHeader) == NFLC_HEADER_SIZE, "header layout");
+
+// Archive geometry fixed at compile time: a BlockSize-byte slot holds a HeaderSize-byte
+// header and one payload, from an uncompressed chunk of ChunkSize bytes unless the packer
+// chose the length. Every size the slot code relies on is derived and checked here, and
+// loadHeader / storeHeader walk NflcBlockHeader's fields at their offsetof positions, which
+// are checked against the on-disk layout below.
+template <uint32_t BlockSize, uint32_t HeaderSize, uint32_t ChunkSize>
+struct NflcBlockCodec {
+    static constexpr uint32_t BLOCK_SIZE = BlockSize;
+    static constexpr uint32_t HEADER_SIZE = HeaderSize;
+    static constexpr uint32_t MAX_PAYLOAD = BlockSize - HeaderSize;
+    static constexpr uint32_t CHUNK_SIZE = ChunkSize;
+    // LZO1X's worst case: incompressible input grows by 1/16 plus a few bytes
+    static constexpr uint32_t CHUNK_BOUND = ChunkSize + ChunkSize / 16 + 64 + 3;
+
+    static_assert(HeaderSize == sizeof(NflcBlockHeader), "header size");
+    static_assert(BlockSize > HeaderSize && MAX_PAYLOAD <= 0xFFFF, "zsize is a 16-bit field");
+    static_assert(ChunkSize > 0 && CHUNK_BOUND > ChunkSize, "chunk size");
+
+    // Calls fn(field, offset) for every numeric header field, in layout order. Offsets come
+    // from NflcBlockHeader itself, so the walk cannot drift from the struct it fills.
+    template <class Header, class Fn>
+    static void forEachField(Header& h, Fn&& fn) {
+        fn(h.version, offsetof(NflcBlockHeader, version));
+        fn(h.blockIndex, offsetof(NflcBlockHeader, blockIndex));
+        fn(h.flags, offsetof(NflcBlockHeader, flags));
+        fn(h.flags2, offsetof(NflcBlockHeader, flags2));
+        fn(h.dummy1, offsetof(NflcBlockHeader, dummy1));
+        fn(h.zsize, offsetof(NflcBlockHeader, zsize));
+        fn(h.checksum1, offsetof(NflcBlockHeader, checksum1));
+        fn(h.blockUncompSize, offsetof(NflcBlockHeader, blockUncompSize));
+        fn(h.checksum2, offsetof(NflcBlockHeader, checksum2));
+        fn(h.totalZSize, offsetof(NflcBlockHeader, totalZSize));
+        fn(h.prevZOffset, offsetof(NflcBlockHeader, prevZOffset));
+        fn(h.totalUncompSize, offsetof(NflcBlockHeader, totalUncompSize));
+        fn(h.prevUncompOffset, offsetof(NflcBlockHeader, prevUncompOffset));
+        fn(h.crcTag, offsetof(NflcBlockHeader, crcTag));
+        fn(h.payloadCrc, offsetof(NflcBlockHeader, payloadCrc));
+        fn(h.dataCrc, offsetof(NflcBlockHeader, dataCrc));
+        fn(h.reserved, offsetof(NflcBlockHeader, reserved));
+    }
+
+    template <class T>
+    static T load(const unsigned char* p) {
+        T v;
+        std::memcpy(&v, p, sizeof(v));
+        if constexpr (std::endian::native != std::endian::little) {
+            v = byteSwap(v);
+        }
+        return v;
+    }
+
+    template <class T>
+    static void store(unsigned char* p, T v) {
+        if constexpr (std::endian::native != std::endian::little) {
+            v = byteSwap(v);
+        }
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    // Header of the slot starting at p (which holds HeaderSize bytes); false without the nFlC magic
+    static bool loadHeader(const unsigned char* p, NflcBlockHeader& hdr) {
+        std::memcpy(hdr.magic, p, sizeof(hdr.magic));
+        forEachField(hdr, [p](auto& field, uint32_t offset) {
+            field = load<std::remove_reference_t<decltype(field)>>(p + offset);
+        });
+        return std::memcmp(hdr.magic, "nFlC", 4) == 0;
+    }
+
+    static void storeHeader(const NflcBlockHeader& hdr, unsigned char* p) {
+        std::memcpy(p, hdr.magic, sizeof(hdr.magic));
+        forEachField(hdr, [p](const auto& field, uint32_t offset) { store(p + offset, field); });
+    }
+
+    static constexpr size_t slotOffset(uint32_t slot) { return static_cast<size_t>(slot) * BlockSize; }
+    static constexpr size_t payloadOffset(uint32_t slot) { return slotOffset(slot) + HeaderSize; }
+    static constexpr uint32_t slotCount(size_t fileSize) {
+        return static_cast<uint32_t>((fileSize + BlockSize - 1) / BlockSize);
+    }
+
+private:
+    template <class T>
+    static T byteSwap(T v) {
+        T out = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            out = static_cast<T>((out << 8) | ((v >> (8 * i)) & 0xFF));
+        }
+        return out;
+    }
+};
+
+// NflcBlockHeader has to match the on-disk header, field for field
+static_assert(offsetof(NflcBlockHeader, version) == 0x04 && offsetof(NflcBlockHeader, blockIndex) == 0x06 &&
+    offsetof(NflcBlockHeader, flags) == 0x08 && offsetof(NflcBlockHeader, flags2) == 0x0C &&
+    offsetof(NflcBlockHeader, dummy1) == 0x10 && offsetof(NflcBlockHeader, zsize) == 0x12 &&
+    offsetof(NflcBlockHeader, checksum1) == 0x14 && offsetof(NflcBlockHeader, blockUncompSize) == 0x18 &&
+    offsetof(NflcBlockHeader, checksum2) == 0x1C && offsetof(NflcBlockHeader, totalZSize) == 0x20 &&
+    offsetof(NflcBlockHeader, prevZOffset) == 0x24 && offsetof(NflcBlockHeader, totalUncompSize) == 0x28 &&
+    offsetof(NflcBlockHeader, prevUncompOffset) == 0x2C && offsetof(NflcBlockHeader, crcTag) == 0x30 &&
+    offsetof(NflcBlockHeader, payloadCrc) == 0x34 && offsetof(NflcBlockHeader, dataCrc) == 0x38 &&
+    offsetof(NflcBlockHeader, reserved) == 0x3C, "header field offsets");
+
+// The geometry of every NFLC archive
+using NflcCodec = NflcBlockCodec<NFLC_BLOCK_SIZE, NFLC_HEADER_SIZE, NFLC_TARGET_CHUNK>;
+
+// Game files leave 0x30..0x3F zeroed; blocks written by this library carry CRC-32C checksums
+// there, marked with this tag ("C32C")
+constexpr uint32_t NFLC_CRC_TAG = 0x43323343;
+
+// Result codes: NFLC_OK (LZO_E_OK), the negative LZO_E_* codes, and these of our own
+constexpr int NFLC_OK = 0;
+constexpr int NFLC_E_PAYLOAD_CRC = -100;
+constexpr int NFLC_E_DATA_CRC = -101;
+constexpr int NFLC_E_CANCELLED = -103;      // nflcProgress().cancel() was called
+
+using NflcByteSpan = std::span<const unsigned char>;
+
+// Initialise the LZO library; call once before anything else. Returns false if the
+// compiled-in miniLZO does not work on this platform.
+bool nflcInit();
+
+// Description of a result code, e.g. "decompressed data checksum mismatch"
+std::string nflcErrorText(int code);
+
+// Parse a command line value that must be a whole decimal number no larger than max
+bool nflcParseCount(const std::string& text, uint64_t max, uint64_t& value);
+
+// Checked decoding goes through the wide-copy decoder in lzo1x_fast.cpp unless the reference
+// one (miniLZO's) is selected; both give the same result for every input
+void nflcUseReferenceDecoder(bool reference);
+const char* nflcDecoderName();
+
+// Pin the workers of nflcParallelFor to one CPU each: worker t gets the t-th CPU the process
+// may run on, wrapping around. A worker's run of items, and the output pages it touches first,
+// then stay on one NUMA node. Off by default, leaving threads to the OS scheduler; a no-op
+// where the platform offers no thread affinity (macOS).
+void nflcSetWorkerAffinity(bool pin);
+bool nflcWorkerAffinity();
+void nflcPinThread(unsigned worker);
+
+// Run fn(i, worker) for every i in [0, count) on up to numThreads workers. Each worker owns
+// a contiguous run of items and works through it front to back, so neighbouring blocks (and
+// the output pages they decode into) stay with one thread. A worker that finishes its run
+// steals the back half of the largest run left. Items complete in no particular order.
+template <typename Fn>
+void nflcParallelFor(uint32_t count, unsigned numThreads, Fn fn) {
+    numThreads = std::min<unsigned>(numThreads, std::max<uint32_t>(count, 1));
+    if (numThreads <= 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            fn(i, 0u);
+        }
+        return;
+    }
+
+    // A run [begin, end) packed into one word, begin in the low half, so that the owner
+    // taking its front and a thief taking its back both claim items with a single CAS
+    struct alignas(64) Run {
+        std::atomic<uint64_t> range;
+    };
+    auto makeRange = [](uint64_t begin, uint64_t end) { return begin | end << 32; };
+    std::vector<Run> runs(numThreads);
+    for (unsigned t = 0; t < numThreads; t++) {
+        runs[t].range.store(makeRange(uint64_t{ count } * t / numThreads, uint64_t{ count } * (t + 1) / numThreads));
+    }
+
+    bool pin = nflcWorkerAffinity();
+    std::vector<std::thread> workers;
+    workers.reserve(numThreads);
+    for (unsigned t = 0; t < numThreads; t++) {
+        workers.emplace_back([&, t]() {
+            if (pin) {
+                nflcPinThread(t);
+            }
+            std::atomic<uint64_t>& own = runs[t].range;
+            for (;;) {
+                uint64_t r = own.load();
+                while (static_cast<uint32_t>(r) < static_cast<uint32_t>(r >> 32)) {
+                    if (own.compare_exchange_weak(r, r + 1)) {
+                        fn(static_cast<uint32_t>(r), t);
+                        r = own.load();
+                    }
+                }
+
+                // Nothing left of our own; split the largest run left. Runs only ever shrink
+                // until their owner has emptied them, so a stale word never matches again.
+                bool stolen = false;
+                while (!stolen) {
+                    unsigned victim = numThreads;
+                    uint32_t largest = 0;
+                    for (unsigned v = 0; v < numThreads; v++) {
+                        uint64_t vr = runs[v].range.load();
+                        uint32_t left = static_cast<uint32_t>(vr >> 32) - static_cast<uint32_t>(vr);
+                        if (left > largest) {
+                            largest = left;
+                            victim = v;
+                        }
+                    }
+                    if (victim == numThreads) {
+                        return;
+                    }
+                    uint64_t vr = runs[victim].range.load();
+                    uint32_t begin = static_cast<uint32_t>(vr);
+                    uint32_t end = static_cast<uint32_t>(vr >> 32);
+                    if (begin >= end) {
+                        continue;
+                    }
+                    uint32_t mid = begin + (end - begin) / 2;
+                    if (runs[victim].range.compare_exchange_strong(vr, makeRange(begin, mid))) {
+                        own.store(makeRange(mid, end));
+                        stolen = true;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+}
+
+// Instrumentation: per-stage time and event counters, shared by all threads and off unless
+// nflcStats().enabled is set. Stage times are summed over threads, so with several workers
+// they can add up to more than the wall-clock time.
+enum class NflcStage { IoRead, HeaderParse, Decompress, DecompressUnchecked, Checksum, BlockCache, Compress, Padding, OutputWrite, Count };
+enum class NflcCounter { BytesIn, BytesOut, Blocks, EmptyBlocks, BadHeaders, UncheckedBlocks, VerifyCacheHits, ChecksumBlocks, ChecksumErrors, CacheHits, CacheMisses, ReusedBlocks, ResyncedHeaders, TrialCompressions, StoredBlocks, PaddingBytes, Count };
+
+extern const char* const NFLC_STAGE_NAMES[];
+extern const char* const NFLC_COUNTER_NAMES[];
+
+struct NflcStats {
+    bool enabled = false;
+    std::atomic<uint64_t> stageNanos[static_cast<size_t>(NflcStage::Count)] = {};
+    std::atomic<uint64_t> counters[static_cast<size_t>(NflcCounter::Count)] = {};
+
+    void count(NflcCounter c, uint64_t n = 1) {
+        if (enabled) {
+            counters[static_cast<size_t>(c)].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+};
+
+NflcStats& nflcStats();
+
+// Adds the time spent in its scope to a stage; costs nothing when stats are off
+class NflcStageTimer {
+public:
+    explicit NflcStageTimer(NflcStage stage) : stage_(stage), active_(nflcStats().enabled) {
+        if (active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~NflcStageTimer() {
+        if (active_) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+            nflcStats().stageNanos[static_cast<size_t>(stage_)].fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+        }
+    }
+    NflcStageTimer(const NflcStageTimer&) = delete;
+    NflcStageTimer& operator=(const NflcStageTimer&) = delete;
+
+private:
+    NflcStage stage_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Progress of the running job and its cancellation token. Every block the library packs,
+// reuses or decodes is added to the counters with relaxed atomics; nothing is printed, so
+// a reporter thread or a GUI samples them at its own rate. The packers and decoders check
+// cancelled() before each block and, once cancel() has been called, stop with
+// NFLC_E_CANCELLED; the rest of a batch then drains without doing any work. cancel() is
+// async-signal-safe. totalBytes is what the caller expects the job to cover (uncompressed
+// bytes in both directions), 0 if it does not know.
+struct NflcProgress {
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> blocks{ 0 };
+    std::atomic<uint64_t> totalBytes{ 0 };
+    std::atomic<bool> cancelRequested{ false };
+
+    void advance(uint64_t n) {
+        blocks.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    void expect(uint64_t n) { totalBytes.fetch_add(n, std::memory_order_relaxed); }
+    void cancel() { cancelRequested.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelRequested.load(std::memory_order_relaxed); }
+    void reset() {
+        bytes = 0;
+        blocks = 0;
+        totalBytes = 0;
+        cancelRequested = false;
+    }
+};
+
+NflcProgress& nflcProgress();
+
+// Read-only view of an entire input file. The file is memory-mapped (mmap / MapViewOfFile)
+// so block headers and compressed payloads can be used in place; if mapping is not possible
+// the contents are read into memory instead.
+class NflcMappedFile {
+public:
+    NflcMappedFile() = default;
+    NflcMappedFile(const NflcMappedFile&) = delete;
+    NflcMappedFile& operator=(const NflcMappedFile&) = delete;
+    ~NflcMappedFile() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+    NflcByteSpan view() const { return NflcByteSpan(data_, size_); }
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<unsigned char> fallback_;
+#ifdef _WIN32
+    void* fileHandle_ = reinterpret_cast<void*>(-1);    // INVALID_HANDLE_VALUE
+    void* mappingHandle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Number of 32KB slots in an archive of fileSize bytes
+uint32_t nflcBlockCount(size_t fileSize);
+
+// Copy out the header of the given 32KB slot. Returns false if the slot is truncated
+// or does not start with the nFlC magic.
+bool nflcReadBlockHeader(NflcByteSpan in, uint32_t blockNum, NflcBlockHeader& hdr);
+
+// CRC-32C checksums of one block, from its header
+struct NflcBlockCrc {
+    bool present = false;
+    uint32_t payload = 0;
+    uint32_t data = 0;
+};
+
+NflcBlockCrc nflcBlockCrc(const NflcBlockHeader& hdr);
+
+// Header-only scan: what each slot holds, and whether the headers agree with each other.
+// prevZOffset / prevUncompOffset of every block should be the running sums of the zsize /
+// blockUncompSize of the valid blocks before it, and the sums should match the totals in
+// the first header.
+enum NflcScanProblem : uint32_t {
+    NFLC_SCAN_BAD_MAGIC = 1u << 0,      // slot does not start with an nFlC header
+    NFLC_SCAN_INDEX = 1u << 1,          // blockIndex is not the slot number
+    NFLC_SCAN_ZOFFSET = 1u << 2,        // prevZOffset breaks the compressed offset chain
+    NFLC_SCAN_UNCOMP_OFFSET = 1u << 3,  // prevUncompOffset breaks the uncompressed offset chain
+    NFLC_SCAN_TRUNCATED = 1u << 4,      // payload runs past the slot or the end of the file
+    NFLC_SCAN_TOTALS = 1u << 5,         // totals differ from the first header's (or, in
+                                        // NflcScan::problems, from the sums of all blocks)
+};
+
+// Names of the NflcScanProblem bits, lowest first
+extern const char* const NFLC_SCAN_PROBLEM_NAMES[6];
+
+struct NflcSlotInfo {
+    uint32_t slot;
+    NflcBlockHeader hdr;        // zeroed when the slot has no valid header
+    uint32_t padding;           // bytes of the slot not holding header or payload
+    uint32_t problems;          // NflcScanProblem bits
+};
+
+struct NflcScan {
+    std::vector<NflcSlotInfo> slots;
+    uint32_t totalZSize = 0;    // from the first header
+    uint32_t totalUncompSize = 0;
+    uint64_t sumZSize = 0;      // over the valid blocks
+    uint64_t sumUncompSize = 0;
+    uint64_t paddingBytes = 0;
+    uint32_t validBlocks = 0;
+    uint32_t problems = 0;      // every slot's bits, plus NFLC_SCAN_TOTALS for the sums
+};
+
+// Scan every slot header of an archive in one pass over in. Returns false if the first slot
+// is not an NFLC header.
+bool nflcScanArchive(NflcByteSpan in, NflcScan& scan);
+
+// Decoded blocks, kept so a block whose payload has been seen before (in this archive, an
+// earlier revision of it or any other) is copied instead of decoded. Blocks are found by
+// key(), a 64-bit XXH64 hash of the compressed payload and the block's two sizes; the
+// position fields of the header are left out so blocks that merely moved still match.
+// Entries live in an in-memory LRU, and when a directory is given also in one file per
+// block there, to be reused by later runs (nothing is ever removed from the directory;
+// delete it to clear the cache). Safe to use from several threads.
+class NflcBlockCache {
+public:
+    explicit NflcBlockCache(size_t memoryBytes, std::string directory = std::string());
+    NflcBlockCache(const NflcBlockCache&) = delete;
+    NflcBlockCache& operator=(const NflcBlockCache&) = delete;
+
+    static uint64_t key(const unsigned char* compData, size_t compSize, size_t uncompSize);
+
+    // Copy the block stored under key into out[0, size); false if there is none of that size
+    bool lookup(uint64_t key, unsigned char* out, size_t size);
+    void store(uint64_t key, const unsigned char* data, size_t size);
+
+    // Lookups so far that found / did not find their block
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t misses() const { return misses_.load(); }
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::vector<unsigned char> data;
+    };
+
+    std::string filePath(uint64_t key) const;
+    void insert(uint64_t key, const unsigned char* data, size_t size);   // mutex_ held
+
+    size_t memoryBytes_;
+    std::string directory_;
+    std::mutex mutex_;
+    std::list<Entry> lru_;                  // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    size_t used_ = 0;
+    std::atomic<uint64_t> tempCounter_{ 0 };
+    std::atomic<uint64_t> hits_{ 0 };
+    std::atomic<uint64_t> misses_{ 0 };
+};
+
+// Decode one block payload into out, which must hold outLen (the header's blockUncompSize) bytes.
+// On return outLen is the number of bytes produced. Bytes of out past outLen may be overwritten.
+// When the header has checksums, the payload is checked before it reaches the decoder and the
+// output after it; each block is checked by the thread that decodes it. trusted selects the
+// unchecked decoder and skips the output checksum (the payload is still checked), and is only
+// for archives that were already decoded cleanly; a failed checked decode is reported, never
+// retried.
+// With a cache, blocks found there are copied out (and still checked against the header's
+// data checksum unless trusted) and blocks that decode cleanly are added to it.
+int nflcDecodePayload(const unsigned char* compData, size_t compSize, unsigned char* out, size_t& outLen,
+    const NflcBlockCrc& crc, bool trusted, NflcBlockCache* cache = nullptr);
+
+// Outcome of decoding one 32KB slot
+enum class NflcSlotStatus { Ok, BadMagic, Empty, Overflow, Failed };
+struct NflcSlotResult {
+    NflcSlotStatus status = NflcSlotStatus::Failed;
+    uint32_t compSize = 0;
+    uint32_t bytesRead = 0;
+    uint32_t outOffset = 0;
+    size_t outLen = 0;
+    int lzoResult = NFLC_OK;
+};
+
+// Decode slot blockNum of an archive into its slice of out (at the header's
+// prevUncompOffset). Safe to call concurrently for different slots.
+void nflcDecodeSlot(NflcByteSpan in, uint32_t blockNum, std::span<unsigned char> out, NflcSlotResult& res, bool trusted,
+    NflcBlockCache* cache = nullptr);
+
+// Zero the bytes of out that no Ok result produced, after decoding into a buffer that was left
+// uninitialised so each page is first touched by the worker decoding into it. Returns the end
+// of the last byte produced.
+size_t nflcZeroUnwritten(std::span<unsigned char> out, const std::vector<NflcSlotResult>& results);
+
+// Scratch buffers owned by one worker thread and reused for every task it runs, so the hot
+// loops stop allocating once the buffers have grown to their working size. Buffers only ever
+// grow; the live length is tracked by the caller.
+struct NflcWorkerBuffers {
+    std::vector<unsigned char> workMem;     // LZO1X-1 dictionary
+    Lzo1xHcScratch hc;                      // high-ratio encoder state (levels 2..9)
+    std::vector<unsigned char> alt;         // auto level: output of the level being tried
+    std::vector<unsigned char> trial;       // packer: output of the current trial compression
+    std::vector<unsigned char> best;        // packer: longest trial known to fit so far
+    std::vector<unsigned char> block;       // decoder: whole block for partial-range copies
+};
+
+std::vector<NflcWorkerBuffers> nflcMakeWorkerBuffers(unsigned count, bool compressing);
+
+// Salvage a damaged archive. Headers are taken from the slot grid where it holds, and where
+// a slot does not start with one (bad sectors, truncation, bytes inserted or lost) the next
+// nFlC magic is searched for, so blocks knocked off the grid are found again. Every block
+// that decodes cleanly (and matches its checksums, if it has them) is placed at its own
+// prevUncompOffset; the rest of the output is left zeroed and reported as damaged. The
+// output reaches the end of the furthest block found, or the totalUncompSize most headers
+// agree on when that is larger, but never past what the input could decode to.
+struct NflcRecoveredBlock {
+    uint64_t fileOffset;        // of the header
+    uint32_t uncompOffset;
+    uint32_t uncompSize;
+    int result;                 // NFLC_OK, a decode error, or NFLC_E_OVERLAP
+};
+
+struct NflcRecovery {
+    std::vector<NflcRecoveredBlock> blocks;                 // every plausible header, in file order
+    std::vector<std::pair<uint64_t, uint64_t>> damaged;     // output ranges [offset, offset + length) left zeroed
+    uint64_t resynced = 0;      // headers found off the slot grid
+    std::string error;          // why nflcRecover() returned false
+};
+
+// Decodes a block that overlaps another one already placed
+constexpr int NFLC_E_OVERLAP = -102;
+
+// Blocks and totals claiming output past maxOutput are ignored. Returns false, with
+// report.error set, if no plausible header was found at all or the output cannot be allocated.
+bool nflcRecover(NflcByteSpan in, std::vector<unsigned char>& out, NflcRecovery& report, unsigned numThreads,
+    uint64_t maxOutput = UINT32_MAX);
+
+// Random access to the uncompressed contents of an NFLC archive. The block index is built
+// once from the slot headers, and reads decode only the blocks that overlap the requested range.
+class NflcReader {
+public:
+    struct BlockEntry {
+        uint32_t slot;              // 32KB slot the block lives in
+        uint32_t compSize;          // zsize, clamped to the bytes present in the file
+        uint32_t uncompOffset;      // prevUncompOffset
+        uint32_t uncompSize;        // blockUncompSize
+        NflcBlockCrc crc;
+    };
+
+    // Map the archive at path, or index one already in memory (which must outlive the reader)
+    bool open(const std::string& path);
+    bool open(NflcByteSpan archive);
+
+    const std::string& error() const { return error_; }
+    uint32_t totalUncompSize() const { return totalUncompSize_; }
+    const std::vector<BlockEntry>& blocks() const { return blocks_; }
+    NflcByteSpan view() const { return data_; }
+
+    // Decode blocks with the unchecked decoder; only for archives that passed verify()
+    void setTrusted(bool trusted) { trusted_ = trusted; }
+    // Look blocks up in (and add them to) cache, which must outlive the reader; verify() does not
+    void setCache(NflcBlockCache* cache) { cache_ = cache; }
+
+    // Index range [first, last) of the blocks overlapping [offset, offset + length)
+    std::pair<size_t, size_t> findBlocks(uint64_t offset, uint64_t length) const;
+
+    // Decode indexed block i into out, which must hold at least blocks()[i].uncompSize bytes.
+    // Safe to call concurrently.
+    int decodeBlock(size_t i, std::span<unsigned char> out, size_t& outLen) const;
+
+    // Fill out[0, length) with the uncompressed bytes starting at offset. Blocks entirely
+    // inside the range are decoded in place; the partial blocks at either end go through a
+    // per-worker scratch buffer that is kept for later reads. Bytes not covered by any block
+    // read as zero.
+    bool readRange(uint64_t offset, uint32_t length, unsigned char* out, unsigned numThreads);
+
+    // Decode every block with the checked decoder, discarding the output
+    bool verify(unsigned numThreads);
+
+private:
+    bool index();
+
+    NflcMappedFile file_;
+    NflcByteSpan data_;
+    std::vector<BlockEntry> blocks_;
+    std::vector<NflcWorkerBuffers> buffers_;
+    uint32_t totalUncompSize_ = 0;
+    bool trusted_ = false;
+    NflcBlockCache* cache_ = nullptr;
+    std::string error_;
+};
+
+// How the packer splits and compresses input
+struct NflcCompressOptions {
+    int level = NFLC_DEFAULT_LEVEL;             // 1..9 or NFLC_LEVEL_AUTO
+    bool pack = false;                          // size each block's input so its payload fills the slot
+    uint32_t maxChunk = NFLC_DEFAULT_MAX_CHUNK; // largest uncompressed block pack may emit
+    bool split = false;                         // pack: end each block where the next one reaches furthest
+    bool verify = false;                        // decode every block as written and compare with its input
+};
+
+// One compressed block produced by the packer; the payload lives in an NflcPayloadArena
+struct NflcChunk {
+    const unsigned char* compData = nullptr;
+    uint32_t uncompSize = 0;
+    uint32_t compSize = 0;
+    uint32_t payloadCrc = 0;    // CRC-32C of the payload
+    uint32_t dataCrc = 0;       // CRC-32C of the uncompressed input
+    const unsigned char* srcData = nullptr;    // the input it was packed from
+};
+
+// Contiguous storage for the compressed payloads of one input. Every packing region owns a
+// fixed stripe sized for the most output it can produce, so workers fill their regions in
+// parallel without locking and payloads are not copied again before they are written.
+// The storage is kept (uninitialised) across reset() calls of the same or smaller size.
+class NflcPayloadArena {
+public:
+    void reset(size_t inputSize, uint32_t regionSize, uint32_t maxChunk);
+
+    unsigned char* stripe(uint32_t region) { return data_.get() + static_cast<size_t>(region) * stride_; }
+    size_t stripeCapacity() const { return stride_; }
+
+private:
+    std::unique_ptr<unsigned char[]> data_;
+    size_t capacity_ = 0;
+    size_t stride_ = 0;
+};
+
+// Input bytes per packing region: fixed 40KB chunks by default, larger regions with pack
+uint32_t nflcRegionSize(const NflcCompressOptions& opts);
+
+// Split [src, src + length) into blocks whose compressed payload fits in one slot, appending
+// the payloads to stripe (which holds stripeCapacity bytes). Each block covers as much of
+// the next maxChunk bytes as fits at the chosen level; the LZO1X-1 search starts from the
+// previous block's length. With split, a block may instead end a little short of that when
+// the next block then covers more: the cut is chosen by fitting the following block from
+// a few candidate ends. Blocks still only reference their own bytes.
+int nflcPackRegion(const unsigned char* src, uint32_t length, uint32_t maxChunk, int level, NflcWorkerBuffers& buffers,
+    unsigned char* stripe, size_t stripeCapacity, std::vector<NflcChunk>& out, bool split = false);
+
+// Compress an in-memory input: split it into regions, pack the regions on one thread per
+// entry of buffers and return the blocks in order, with their payloads in arena. On failure
+// returns the LZO error and sets failOffset to the start of the failing region. When
+// taskSeconds is given it receives the time spent on each region.
+int nflcPackBuffer(const unsigned char* data, size_t size, const NflcCompressOptions& opts,
+    std::vector<NflcWorkerBuffers>& buffers, NflcPayloadArena& arena, std::vector<NflcChunk>& chunks,
+    uint32_t& totalZSize, uint64_t& failOffset, std::vector<double>* taskSeconds = nullptr);
+
+// Incremental form of nflcPackBuffer for an edited copy of the data in base. Base blocks that
+// lie inside a region and decode to exactly the bytes now at their offset (checked with the
+// base's CRC-32C first where it has one, then by decoding and comparing) have their payloads
+// reused as they are. Only the input between them is packed, so reuse picks up again at the
+// first unchanged base block after an edit. Reused chunks point into base, which must stay open until they have been
+// written. reusedBytes receives the amount of input covered by reused blocks.
+int nflcPackIncremental(const unsigned char* data, size_t size, const NflcReader& base, const NflcCompressOptions& opts,
+    std::vector<NflcWorkerBuffers>& buffers, NflcPayloadArena& arena, std::vector<NflcChunk>& chunks,
+    uint32_t& totalZSize, uint64_t& failOffset, uint64_t& reusedBytes);
+
+// Destination for a written archive
+class NflcSink {
+public:
+    virtual ~NflcSink() = default;
+    virtual bool write(const void* data, size_t len) = 0;
+    // Overwrite len bytes at offset, already written, and carry on appending after them.
+    // Only needed when the archive totals are not known up front; sinks that cannot seek
+    // return false.
+    virtual bool writeAt(uint64_t offset, const void* data, size_t len) = 0;
+    // The next bytes bytes are about to be written, so space for them can be set aside now.
+    // False only if the sink knows they will not fit.
+    virtual bool reserve(uint64_t bytes) { (void)bytes; return true; }
+};
+
+// Archive kept in memory
+class NflcMemorySink : public NflcSink {
+public:
+    bool write(const void* data, size_t len) override;
+    bool writeAt(uint64_t offset, const void* data, size_t len) override;
+    bool reserve(uint64_t bytes) override;
+
+    std::vector<unsigned char>& data() { return data_; }
+
+private:
+    std::vector<unsigned char> data_;
+};
+
+// Output written to a file. Small writes (a block's header, payload and padding) are gathered
+// in an aligned staging buffer that goes out as one large write at an aligned file offset, and
+// reserve() preallocates the space (posix_fallocate, or the allocation size on Windows) so the
+// file does not grow one write at a time. With direct, the file bypasses the OS cache
+// (O_DIRECT, F_NOCACHE on macOS, FILE_FLAG_NO_BUFFERING on Windows) for outputs too large to
+// be worth caching; where the file system refuses that, writes fall back to the cache.
+// writeAt() patches bytes still in the buffer in place and earlier ones with a positioned
+// write (a read-modify-write of the aligned pages around them in direct mode).
+class NflcFileSink : public NflcSink {
+public:
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1 << 20;
+
+    NflcFileSink() = default;
+    NflcFileSink(const NflcFileSink&) = delete;
+    NflcFileSink& operator=(const NflcFileSink&) = delete;
+    ~NflcFileSink() { close(); }
+
+    // bufferSize is rounded up to a multiple of ALIGNMENT
+    bool open(const std::string& path, bool direct = false, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    // Flush, trim any preallocated space past the end and close; false if any write failed
+    bool close();
+    // Close without flushing and delete the file, for a run that stops part way
+    void discard();
+
+    bool write(const void* data, size_t len) override;
+    bool writeAt(uint64_t offset, const void* data, size_t len) override;
+    bool reserve(uint64_t bytes) override;
+
+    uint64_t size() const { return size_; }
+    // Whether writes are still bypassing the OS cache
+    bool direct() const { return direct_; }
+
+private:
+    struct AlignedDelete {
+        void operator()(unsigned char* p) const { ::operator delete[](p, std::align_val_t(ALIGNMENT)); }
+    };
+    using AlignedBuffer = std::unique_ptr<unsigned char[], AlignedDelete>;
+    static AlignedBuffer allocate(size_t size);
+
+    // Write the full buffer, or with final set whatever is in it
+    bool flushBuffer(bool final);
+    // Positioned I/O on the file; offsets, lengths and addresses must be aligned in direct mode
+    bool writeFile(uint64_t offset, const unsigned char* data, size_t len);
+    bool readFile(uint64_t offset, unsigned char* data, size_t len);
+    // Shrink or extend the file to size
+    bool truncateFile(uint64_t size);
+    void leaveDirectMode();
+
+#ifdef _WIN32
+    void* handle_ = reinterpret_cast<void*>(static_cast<intptr_t>(-1));   // INVALID_HANDLE_VALUE
+#else
+    int fd_ = -1;
+#endif
+    std::string path_;
+    AlignedBuffer buffer_;
+    size_t bufferSize_ = 0;
+    size_t used_ = 0;                   // bytes staged in buffer_
+    uint64_t bufferOffset_ = 0;         // file offset of buffer_[0]; everything before it is written
+    uint64_t size_ = 0;
+    uint64_t reserved_ = 0;             // bytes preallocated from the start of the file
+    bool direct_ = false;
+    bool ok_ = true;
+};
+
+// Round-trip check of blocks as they are written. NflcBlockWriter hands over a copy of each
+// block's header and payload exactly as they went to the sink; background threads parse the
+// header back, decode the payload with the checked decoder and compare both with the
+// verifier's own account of the archive: the running sum of block sizes gives the offset and
+// input range every block must have, and the source given to beginArchive / addSource gives
+// the bytes it must decode to. A bad zsize, offset, CRC, split or payload is caught before
+// the archive ships. submit() only queues, so checking overlaps the rest of the job;
+// failed() turns true at the first mismatch and the writer stops there. Source bytes must
+// stay valid until drain() returns.
+class NflcBlockVerifier {
+public:
+    explicit NflcBlockVerifier(unsigned numThreads);
+    NflcBlockVerifier(const NflcBlockVerifier&) = delete;
+    NflcBlockVerifier& operator=(const NflcBlockVerifier&) = delete;
+    ~NflcBlockVerifier();
+
+    // The blocks submitted from here on start a new archive whose uncompressed contents begin
+    // with source; addSource appends the next piece of them, for writers that get input in batches
+    void beginArchive(NflcByteSpan source);
+    void addSource(NflcByteSpan source);
+
+    // written: the header and payload bytes given to the sink
+    void submit(uint32_t blockIndex, std::vector<unsigned char> written, const NflcChunk& chunk);
+    // Wait until every submitted block is checked; false if any did not match
+    bool drain();
+
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+    // First mismatch found, e.g. "block 12: decoded data differs from the input"
+    std::string error() const;
+    uint64_t verifiedBlocks() const { return verified_.load(std::memory_order_relaxed); }
+
+private:
+    struct Job {
+        uint32_t blockIndex;
+        std::vector<unsigned char> written;
+        NflcChunk chunk;
+        uint64_t uncompOffset;              // where the block has to start, from the running sum
+        const unsigned char* source;        // its input in the source, or null if past the end of it
+    };
+
+    void run();
+    // Empty when the block round-trips
+    std::string check(const Job& job, std::vector<unsigned char>& buf) const;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;     // jobs queued, or stopping
+    std::condition_variable idle_;      // queue empty and no job in progress
+    std::deque<Job> queue_;
+    unsigned busy_ = 0;
+    bool stop_ = false;
+    std::atomic<bool> failed_{ false };
+    std::atomic<uint64_t> verified_{ 0 };
+    uint32_t errorBlock_ = 0;
+    std::string error_;
+    std::vector<std::thread> threads_;
+    // Submitting thread only
+    uint64_t uncompOffset_ = 0;         // sum of the uncompSize of the archive's blocks so far
+    NflcByteSpan source_;               // the latest piece of source, which starts at sourceStart_
+    uint64_t sourceStart_ = 0;
+};
+
+// Serialises blocks as consecutive 32KB slots, each a header followed by its payload and
+// zero padding (the last slot is left unpadded). A slot is padded only when the next block is
+// appended, so blocks can be written as they are produced without knowing which one is last.
+// When the totals are not known up front, patchTotals() rewrites them into every header once
+// the last block is in; that needs a sink that supports writeAt(). A chunk whose payload
+// does not fit a slot is refused rather than written over the next one.
+class NflcBlockWriter {
+public:
+    NflcBlockWriter(NflcSink& sink, uint32_t totalZSize, uint32_t totalUncompSize, NflcBlockVerifier* verifier = nullptr)
+        : sink_(sink), totalZSize_(totalZSize), totalUncompSize_(totalUncompSize), verifier_(verifier) {}
+
+    // False on a write error, an oversized chunk, or once the verifier has found a mismatch
+    bool append(const NflcChunk& ci);
+
+    // Store the final totals in every header written so far
+    bool patchTotals(uint32_t totalZSize, uint32_t totalUncompSize);
+
+    uint32_t blocks() const { return blocks_; }
+    uint64_t bytesWritten() const { return position_; }
+    uint64_t zSize() const { return prevZOffset_; }
+    uint64_t uncompSize() const { return prevUncompOffset_; }
+
+private:
+    NflcSink& sink_;
+    uint32_t totalZSize_;
+    uint32_t totalUncompSize_;
+    NflcBlockVerifier* verifier_;
+    uint32_t blocks_ = 0;
+    uint64_t position_ = 0;
+    uint64_t prevZOffset_ = 0;
+    uint64_t prevUncompOffset_ = 0;
+};
+
+// Write packed chunks whose totals are already known
+bool nflcWriteBlocks(NflcSink& sink, const std::vector<NflcChunk>& chunks, uint32_t totalZSize, uint32_t totalUncompSize,
+    NflcBlockVerifier* verifier = nullptr);
+
+// Push-style archive writer: append() uncompressed data in pieces of any size and finish()
+// once it is all in. Input is packed a batch of whole regions at a time on the worker
+// threads and written out immediately, so memory stays bounded by the batch size and the
+// block layout matches compressing the whole input at once. Headers go out with zero
+// totals that finish() patches in, so the sink has to support writeAt(). With opts.verify
+// the batch just written stays in memory and is checked while the next one is packed.
+class NflcWriter {
+public:
+    NflcWriter(NflcSink& sink, const NflcCompressOptions& opts, unsigned numThreads);
+
+    bool append(NflcByteSpan data);
+    bool finish();
+
+    // Called for every block as it is written
+    void onBlock(std::function<void(uint32_t index, const NflcChunk& chunk)> fn) { onBlock_ = std::move(fn); }
+
+    const std::string& error() const { return error_; }
+    // True once a written block failed its round-trip check
+    bool verifyFailed() const { return verifier_ && verifier_->failed(); }
+    uint32_t blocks() const { return writer_.blocks(); }
+    uint64_t bytesWritten() const { return writer_.bytesWritten(); }
+    uint64_t zSize() const { return writer_.zSize(); }
+    uint64_t inputSize() const { return inputSize_ + fill_; }
+
+private:
+    bool flush();
+
+    NflcCompressOptions opts_;
+    std::unique_ptr<NflcBlockVerifier> verifier_;
+    NflcBlockWriter writer_;
+    std::vector<NflcWorkerBuffers> buffers_;
+    NflcPayloadArena arena_;
+    std::vector<NflcChunk> chunks_;
+    std::vector<unsigned char> batch_;
+    std::vector<unsigned char> spareBatch_;   // verify: the previous batch's input, still being checked
+    size_t fill_ = 0;
+    uint64_t inputSize_ = 0;        // bytes packed so far
+    bool finished_ = false;
+    std::function<void(uint32_t, const NflcChunk&)> onBlock_;
+    std::string error_;
+};
+
+// Multi-file packs: many archives in one file, so a loader opens one file and reads members
+// by offset instead of opening one small .nflc per asset. The file starts with an
+// NflcPackHeader, the member table and the member names, padded to a slot boundary. Each
+// member follows it as an ordinary NFLC archive that starts on a slot boundary, so anything
+// that reads .nflc can read a member given its offset. Hot members come first and back to
+// back, so a loader can read all of them in one sequential pass. Like block headers, the
+// table is little-endian on disk; both structs are naturally aligned and are loaded and
+// stored field by field at their offsetof positions.
+struct NflcPackHeader {
+    char magic[4];              // "nFlP"
+    uint32_t version;           // 1
+    uint32_t memberCount;
+    uint32_t tableSize;         // bytes of header, entries and names
+    uint32_t dataSlot;          // first slot after the table
+    uint32_t hotSlots;          // slots from dataSlot on that hold the hot members
+    uint32_t reserved[2];
+};
+
+struct NflcPackEntry {
+    uint32_t firstSlot;
+    uint32_t slotCount;
+    uint64_t size;              // bytes of the member's archive
+    uint32_t uncompSize;
+    uint32_t flags;             // NFLC_PACK_HOT
+    uint32_t nameOffset;        // from the start of the file
+    uint32_t nameLength;
+};
+static_assert(sizeof(NflcPackHeader) == 32 && sizeof(NflcPackEntry) == 32, "pack table layout");
+static_assert(offsetof(NflcPackHeader, version) == 0x04 && offsetof(NflcPackHeader, memberCount) == 0x08 &&
+    offsetof(NflcPackHeader, tableSize) == 0x0C && offsetof(NflcPackHeader, dataSlot) == 0x10 &&
+    offsetof(NflcPackHeader, hotSlots) == 0x14 && offsetof(NflcPackHeader, reserved) == 0x18 &&
+    offsetof(NflcPackEntry, slotCount) == 0x04 && offsetof(NflcPackEntry, size) == 0x08 &&
+    offsetof(NflcPackEntry, uncompSize) == 0x10 && offsetof(NflcPackEntry, flags) == 0x14 &&
+    offsetof(NflcPackEntry, nameOffset) == 0x18 && offsetof(NflcPackEntry, nameLength) == 0x1C,
+    "pack table field offsets");
+
+constexpr uint32_t NFLC_PACK_VERSION = 1;
+constexpr uint32_t NFLC_PACK_HOT = 1u << 0;
+
+// True if in starts with an NflcPackHeader
+bool nflcIsPack(NflcByteSpan in);
+
+struct NflcPackInput {
+    std::string name;
+    NflcByteSpan data;
+    bool hot = false;
+};
+
+// Compress members and write them as a pack. The regions of all members are packed on one
+// pool of numThreads workers, so small members do not leave threads idle. Members keep
+// their order, except that hot ones move to the front. Returns false and sets error on failure.
+bool nflcWritePack(NflcSink& sink, const std::vector<NflcPackInput>& members, const NflcCompressOptions& opts,
+    unsigned numThreads, std::string& error);
+
+// The member table of a mapped pack. member(i) is the member's archive, for NflcReader::open.
+class NflcPackReader {
+public:
+    struct Member {
+        std::string name;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t uncompSize;
+        bool hot;
+    };
+
+    // Map the pack at path, or read one already in memory (which must outlive the reader)
+    bool open(const std::string& path);
+    bool open(NflcByteSpan pack);
+
+    const std::string& error() const { return error_; }
+    const std::vector<Member>& members() const { return members_; }
+    NflcByteSpan member(size_t i) const { return data_.subspan(members_[i].offset, members_[i].size); }
+    // The run of hot members at the front of the data, which starts hotOffset() bytes into the file
+    NflcByteSpan hotData() const { return data_.subspan(hotOffset_, hotSize_); }
+    uint64_t hotOffset() const { return hotOffset_; }
+
+private:
+    bool parse();
+
+    NflcMappedFile file_;
+    NflcByteSpan data_;
+    std::vector<Member> members_;
+    uint64_t hotOffset_ = 0;
+    uint64_t hotSize_ = 0;
+    std::string error_;
+};
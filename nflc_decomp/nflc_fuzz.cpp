@@ -0,0 +1,100 @@
+// libFuzzer harness for the archive readers: every entry point that parses untrusted
+// archive bytes gets the fuzz input as an archive. The input itself, and the payload of every
+// slot, is also decoded by both lzo1x_decompress_safe and lzo1xDecompressFast, which must
+// agree on the result, the output length and every output byte; any difference aborts.
+// Build with `make fuzz` (needs clang);
+// defining NFLC_FUZZ_MAIN instead adds a main() that runs the harness over files given on
+// the command line, for replaying crashes with any compiler.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "lzo1x_fast.h"
+#include "minilzo.h"
+#include "nflc.h"
+
+namespace {
+
+// Outputs claiming more than this are skipped rather than allocated
+constexpr uint32_t FUZZ_MAX_OUTPUT = 64 * 1024 * 1024;
+
+// Output room for decoding the raw input as one LZO1X stream
+constexpr size_t FUZZ_STREAM_OUTPUT = 1024 * 1024;
+
+// Decode src into dstLen bytes with the reference decoder and the wide-copy one
+void compareDecoders(const unsigned char* src, size_t srcLen, size_t dstLen) {
+    static std::vector<unsigned char> ref;
+    static std::vector<unsigned char> fast;
+    ref.assign(dstLen + 1, 0);
+    fast.assign(dstLen + 1, 0);
+    lzo_uint refLen = dstLen;
+    int refResult = lzo1x_decompress_safe(src, srcLen, ref.data(), &refLen, nullptr);
+    size_t fastLen = dstLen;
+    int fastResult = lzo1xDecompressFast(src, srcLen, fast.data(), fastLen);
+    if (refResult != fastResult || refLen != fastLen || std::memcmp(ref.data(), fast.data(), refLen) != 0) {
+        std::fprintf(stderr, "Decoder mismatch on %zu input bytes into %zu: safe %d/%zu, fast (%s) %d/%zu\n",
+            srcLen, dstLen, refResult, static_cast<size_t>(refLen), lzo1xFastKernel(), fastResult, fastLen);
+        std::abort();
+    }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static bool initialised = nflcInit();
+    if (!initialised) {
+        return 0;
+    }
+    NflcByteSpan in(data, size);
+
+    // The raw input as a payload, with ample room and with too little
+    compareDecoders(data, size, FUZZ_STREAM_OUTPUT);
+    compareDecoders(data, size, size);
+
+    NflcScan scan;
+    nflcScanArchive(in, scan);
+
+    NflcReader reader;
+    if (reader.open(in) && reader.totalUncompSize() <= FUZZ_MAX_OUTPUT) {
+        std::vector<unsigned char> out(reader.totalUncompSize());
+        reader.readRange(0, reader.totalUncompSize(), out.data(), 1);
+        reader.verify(1);
+    }
+
+    std::vector<unsigned char> recovered;
+    NflcRecovery report;
+    nflcRecover(in, recovered, report, 1, FUZZ_MAX_OUTPUT);
+
+    // Plain slot decoding, as decompress() does it
+    uint32_t numBlocks = nflcBlockCount(size);
+    std::vector<unsigned char> slotOut(std::min<size_t>(recovered.size(), FUZZ_MAX_OUTPUT));
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        NflcSlotResult res;
+        nflcDecodeSlot(in, i, slotOut, res, false);
+
+        NflcBlockHeader hdr;
+        if (nflcReadBlockHeader(in, i, hdr)) {
+            size_t payload = static_cast<size_t>(i) * NFLC_BLOCK_SIZE + NFLC_HEADER_SIZE;
+            size_t zsize = std::min<size_t>(hdr.zsize, size - std::min(size, payload));
+            compareDecoders(data + std::min(size, payload), zsize,
+                std::min<uint64_t>(hdr.blockUncompSize, nflcMaxDecodedSize(hdr.zsize)));
+        }
+    }
+    return 0;
+}
+
+#ifdef NFLC_FUZZ_MAIN
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::ifstream ifs(argv[i], std::ios::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+        std::printf("%s: ok\n", argv[i]);
+    }
+    return 0;
+}
+#endif
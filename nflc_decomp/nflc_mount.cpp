@@ -0,0 +1,344 @@
+// Read-only FUSE mount of NFLC archives: every archive under the source directory appears
+// as its decompressed file, and every pack as a directory of its members. Nothing is
+// decoded up front. Sizes come from the first block header (or the pack table), a file's
+// block index is built when it is first opened, and a read decodes only the 32KB-slot
+// blocks that overlap it. Decoded blocks are kept in a bounded in-memory LRU shared by all
+// files. Build with `make mount` (needs libfuse3 and pkg-config).
+//
+//   nflc_mount SOURCE MOUNTPOINT [--cache-mem MB] [FUSE options, e.g. -f, -o allow_other]
+//
+// SOURCE is a directory, searched recursively, or a single archive or pack. Files are
+// recognised by their magic, not their extension; a trailing .nflc or .nflp is dropped
+// from the mounted name, and anything else in SOURCE is left out.
+#define FUSE_USE_VERSION 31
+
+#include <fuse.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nflc.h"
+
+namespace {
+
+// A file or directory of the mounted tree
+struct MountEntry {
+    bool directory = false;
+    std::vector<std::string> children;      // names, for directories
+    time_t mtime = 0;
+
+    // Files: the archive on disk, or a member of a pack
+    std::string archivePath;
+    const NflcPackReader* pack = nullptr;
+    size_t member = 0;
+    uint64_t size = 0;
+
+    // Opened on first use and dropped when the last handle is released
+    std::mutex mutex;
+    unsigned openCount = 0;
+    std::unique_ptr<NflcReader> reader;
+};
+
+struct MountState {
+    std::map<std::string, std::unique_ptr<MountEntry>> entries;   // by path, "/" is the root
+    std::vector<std::unique_ptr<NflcPackReader>> packs;
+    std::unique_ptr<NflcBlockCache> cache;
+};
+
+MountState g_mount;
+
+std::string joinPath(const std::string& dir, const std::string& name) {
+    return dir == "/" ? "/" + name : dir + "/" + name;
+}
+
+// The directory at path, creating it and its parents as needed; nullptr if a file is in the way
+MountEntry* addDirectory(const std::string& path, time_t mtime) {
+    auto it = g_mount.entries.find(path);
+    if (it != g_mount.entries.end()) {
+        return it->second->directory ? it->second.get() : nullptr;
+    }
+    if (path == "/") {
+        auto root = std::make_unique<MountEntry>();
+        root->directory = true;
+        root->mtime = mtime;
+        return (g_mount.entries[path] = std::move(root)).get();
+    }
+    size_t slash = path.find_last_of('/');
+    MountEntry* parent = addDirectory(slash == 0 ? "/" : path.substr(0, slash), mtime);
+    if (parent == nullptr) {
+        return nullptr;
+    }
+    parent->children.push_back(path.substr(slash + 1));
+    auto entry = std::make_unique<MountEntry>();
+    entry->directory = true;
+    entry->mtime = mtime;
+    return (g_mount.entries[path] = std::move(entry)).get();
+}
+
+// A new file entry at dir/name; nullptr if the name is already taken
+MountEntry* addFile(const std::string& dir, const std::string& name, time_t mtime) {
+    MountEntry* parent = addDirectory(dir, mtime);
+    std::string path = joinPath(dir, name);
+    if (parent == nullptr || name.empty() || g_mount.entries.count(path) != 0) {
+        std::cerr << "Warning: Skipping " << path << ": name already in use\n";
+        return nullptr;
+    }
+    parent->children.push_back(name);
+    auto entry = std::make_unique<MountEntry>();
+    entry->mtime = mtime;
+    return (g_mount.entries[path] = std::move(entry)).get();
+}
+
+std::string mountedName(const std::filesystem::path& file) {
+    std::string ext = file.extension().string();
+    return ext == ".nflc" || ext == ".nflp" ? file.stem().string() : file.filename().string();
+}
+
+// Add the archive or pack at file under dir (a pack's members go into dir itself when
+// asDirectory is false). Files that are neither are ignored.
+void addSource(const std::filesystem::path& file, const std::string& dir, bool asDirectory) {
+    unsigned char head[NFLC_HEADER_SIZE] = {};
+    std::ifstream ifs(file, std::ios::binary);
+    ifs.read(reinterpret_cast<char*>(head), sizeof(head));
+    NflcByteSpan headSpan(head, static_cast<size_t>(ifs.gcount()));
+    std::error_code ec;
+    auto writeTime = std::filesystem::last_write_time(file, ec);
+    time_t mtime = ec ? 0 : std::chrono::system_clock::to_time_t(
+        std::chrono::file_clock::to_sys(std::chrono::time_point_cast<std::chrono::system_clock::duration>(writeTime)));
+
+    NflcBlockHeader hdr;
+    if (nflcReadBlockHeader(headSpan, 0, hdr)) {
+        MountEntry* entry = addFile(dir, mountedName(file), mtime);
+        if (entry != nullptr) {
+            entry->archivePath = file.string();
+            entry->size = hdr.totalUncompSize;
+        }
+        return;
+    }
+    if (!nflcIsPack(headSpan)) {
+        return;
+    }
+
+    auto pack = std::make_unique<NflcPackReader>();
+    if (!pack->open(file.string())) {
+        std::cerr << "Warning: Skipping " << file.string() << ": " << pack->error() << "\n";
+        return;
+    }
+    std::string packDir = asDirectory ? joinPath(dir, mountedName(file)) : dir;
+    if (addDirectory(packDir, mtime) == nullptr) {
+        std::cerr << "Warning: Skipping " << packDir << ": name already in use\n";
+        return;
+    }
+    for (size_t i = 0; i < pack->members().size(); i++) {
+        const NflcPackReader::Member& m = pack->members()[i];
+        // Member names come from the pack; keep them inside the pack's directory
+        std::filesystem::path name(m.name);
+        bool safe = !name.empty() && name.is_relative() && !name.has_root_name();
+        std::string memberDir = packDir;
+        for (const std::filesystem::path& part : name.parent_path()) {
+            safe = safe && part != ".." && part != ".";
+            memberDir = joinPath(memberDir, part.string());
+        }
+        if (!safe || name.filename() == ".." || name.filename() == ".") {
+            std::cerr << "Warning: Skipping member with unsafe name: " << m.name << "\n";
+            continue;
+        }
+        MountEntry* entry = addFile(memberDir, name.filename().string(), mtime);
+        if (entry != nullptr) {
+            entry->pack = pack.get();
+            entry->member = i;
+            entry->size = m.uncompSize;
+        }
+    }
+    g_mount.packs.push_back(std::move(pack));
+}
+
+MountEntry* findEntry(const char* path) {
+    auto it = g_mount.entries.find(path);
+    return it == g_mount.entries.end() ? nullptr : it->second.get();
+}
+
+void* mountInit(struct fuse_conn_info*, struct fuse_config* cfg) {
+    // Archives do not change while mounted, so the kernel may keep pages across opens
+    cfg->kernel_cache = 1;
+    return nullptr;
+}
+
+int mountGetattr(const char* path, struct stat* st, struct fuse_file_info*) {
+    MountEntry* entry = findEntry(path);
+    if (entry == nullptr) {
+        return -ENOENT;
+    }
+    std::memset(st, 0, sizeof(*st));
+    st->st_mode = entry->directory ? (S_IFDIR | 0555) : (S_IFREG | 0444);
+    st->st_nlink = entry->directory ? 2 : 1;
+    st->st_size = static_cast<off_t>(entry->size);
+    st->st_mtime = entry->mtime;
+    return 0;
+}
+
+int mountReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info*,
+    enum fuse_readdir_flags) {
+    MountEntry* entry = findEntry(path);
+    if (entry == nullptr || !entry->directory) {
+        return -ENOENT;
+    }
+    filler(buf, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    filler(buf, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    for (const std::string& name : entry->children) {
+        filler(buf, name.c_str(), nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    }
+    return 0;
+}
+
+int mountOpen(const char* path, struct fuse_file_info* fi) {
+    MountEntry* entry = findEntry(path);
+    if (entry == nullptr) {
+        return -ENOENT;
+    }
+    if (entry->directory) {
+        return -EISDIR;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EROFS;
+    }
+
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (entry->reader == nullptr) {
+        auto reader = std::make_unique<NflcReader>();
+        bool ok = entry->pack != nullptr ? reader->open(entry->pack->member(entry->member))
+            : reader->open(entry->archivePath);
+        if (!ok && entry->size > 0) {
+            std::cerr << "Error: " << path << ": " << reader->error() << "\n";
+            return -EIO;
+        }
+        reader->setCache(g_mount.cache.get());
+        entry->reader = std::move(reader);
+    }
+    entry->openCount++;
+    fi->fh = reinterpret_cast<uint64_t>(entry);
+    fi->keep_cache = 1;
+    return 0;
+}
+
+int mountRead(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    MountEntry* entry = reinterpret_cast<MountEntry*>(fi->fh);
+    if (offset < 0 || static_cast<uint64_t>(offset) >= entry->size) {
+        return 0;
+    }
+    uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(size, entry->size - offset));
+
+    // The reader's scratch buffers are per reader, so reads of one file take turns
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (!entry->reader->readRange(offset, length, reinterpret_cast<unsigned char*>(buf), 1)) {
+        std::cerr << "Error: " << path << ": " << entry->reader->error() << "\n";
+        return -EIO;
+    }
+    return static_cast<int>(length);
+}
+
+int mountRelease(const char*, struct fuse_file_info* fi) {
+    MountEntry* entry = reinterpret_cast<MountEntry*>(fi->fh);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (--entry->openCount == 0) {
+        entry->reader.reset();
+    }
+    return 0;
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "Usage: " << programName << " SOURCE MOUNTPOINT [--cache-mem MB] [FUSE options]\n";
+    std::cerr << "  Mount the NFLC archives and packs in SOURCE (a directory or one file) read-only\n";
+    std::cerr << "  at MOUNTPOINT, decoding blocks only when a read touches them\n";
+    std::cerr << "  --cache-mem MB  Decoded blocks kept in memory across reads (default 64)\n";
+    std::cerr << "  -f              Stay in the foreground; unmount with fusermount3 -u MOUNTPOINT\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Our own options; everything else, with the mount point, goes to FUSE
+    size_t cacheMemMB = 64;
+    std::vector<char*> fuseArgs = { argv[0] };
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cache-mem") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a size in MB\n";
+                return 1;
+            }
+            uint64_t value = 0;
+            if (!nflcParseCount(argv[++i], std::min<uint64_t>(UINT_MAX, SIZE_MAX / (1024 * 1024)), value)) {
+                std::cerr << "Error: Invalid cache size '" << argv[i] << "'\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+            cacheMemMB = static_cast<size_t>(value);
+        }
+        else {
+            fuseArgs.push_back(argv[i]);
+        }
+    }
+
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+    g_mount.cache = std::make_unique<NflcBlockCache>(cacheMemMB * 1024 * 1024);
+
+    std::filesystem::path source(argv[1]);
+    std::error_code ec;
+    addDirectory("/", 0);
+    if (std::filesystem::is_directory(source, ec)) {
+        auto options = std::filesystem::directory_options::skip_permission_denied;
+        for (auto it = std::filesystem::recursive_directory_iterator(source, options, ec);
+            !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (!it->is_regular_file(ec)) {
+                continue;
+            }
+            std::string dir = "/";
+            for (const std::filesystem::path& part : it->path().lexically_relative(source).parent_path()) {
+                dir = joinPath(dir, part.string());
+            }
+            addSource(it->path(), dir, true);
+        }
+    }
+    else if (std::filesystem::is_regular_file(source, ec)) {
+        addSource(source, "/", false);
+    }
+    else {
+        std::cerr << "Error: Cannot open source: " << source.string() << "\n";
+        return 1;
+    }
+    std::cerr << "Mounting " << g_mount.entries.size() - 1 << " entries from " << source.string() << "\n";
+
+    struct fuse_operations ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.init = mountInit;
+    ops.getattr = mountGetattr;
+    ops.readdir = mountReaddir;
+    ops.open = mountOpen;
+    ops.read = mountRead;
+    ops.release = mountRelease;
+    return fuse_main(static_cast<int>(fuseArgs.size()), fuseArgs.data(), &ops, nullptr);
+}
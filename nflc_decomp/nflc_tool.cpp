@@ -1,430 +1,2556 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <cstdint>
-#include <cstring>
-#include <string>
-#include <iomanip>
-#include <algorithm>
-
-extern "C" {
-#include "minilzo.h"
-}
-
-// Constants
-constexpr uint32_t BLOCK_SIZE = 32768;  // 32KB blocks
-constexpr uint32_t HEADER_SIZE = 64;    // 64-byte header per block
-
-// NFLC Block Header structure (64 bytes)
-#pragma pack(push, 1)
-struct NflcBlockHeader {
-    char magic[4];              // 0x00: "nFlC"
-    uint16_t version;           // 0x04: Version (usually 0x0101)
-    uint16_t blockIndex;        // 0x06: Block index (0, 1, 2, ...)
-    uint32_t flags;             // 0x08: Flags (0x80000012 for LZO)
-    uint32_t flags2;            // 0x0C: Additional flags
-    uint16_t dummy1;            // 0x10: Unknown
-    uint16_t zsize;             // 0x12: Compressed size in this block
-    uint32_t checksum1;         // 0x14: Checksum or identifier
-    uint32_t blockUncompSize;   // 0x18: Uncompressed size of this block
-    uint32_t checksum2;         // 0x1C: Another checksum
-    uint32_t totalZSize;        // 0x20: Total compressed size (all blocks)
-    uint32_t prevZOffset;       // 0x24: Cumulative compressed offset (previous blocks)
-    uint32_t totalUncompSize;   // 0x28: Total uncompressed size (all blocks)
-    uint32_t prevUncompOffset;  // 0x2C: Cumulative uncompressed offset (previous blocks)
-    char padding[16];           // 0x30: Padding zeros
-};
-#pragma pack(pop)
-
-void printUsage(const char* programName) {
-    std::cerr << "NFLC Multi-Block Compress/Decompress Tool for Ultimate Spider-Man\n";
-    std::cerr << "Usage:\n";
-    std::cerr << "  Decompress: " << programName << " -d input.nflc output.bin\n";
-    std::cerr << "  Compress:   " << programName << " -c input.bin output.nflc\n";
-    std::cerr << "  Info:       " << programName << " -i input.nflc\n";
-}
-
-void printBlockHeader(const NflcBlockHeader& hdr, uint32_t blockNum) {
-    std::cout << "--- Block " << blockNum << " ---\n";
-    std::cout << "  Block Index: " << hdr.blockIndex << "\n";
-    std::cout << "  Compressed size (zsize): " << hdr.zsize << " bytes\n";
-    std::cout << "  Block uncompressed size: " << hdr.blockUncompSize << " bytes\n";
-    std::cout << "  Prev Z offset: " << hdr.prevZOffset << "\n";
-    std::cout << "  Prev uncomp offset: " << hdr.prevUncompOffset << "\n";
-}
-
-int showInfo(const std::string& inputFile) {
-    std::ifstream ifs(inputFile, std::ios::binary);
-    if (!ifs.is_open()) {
-        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
-        return 1;
-    }
-
-    // Get file size
-    ifs.seekg(0, std::ios::end);
-    std::streamoff fileSize = ifs.tellg();
-    ifs.seekg(0, std::ios::beg);
-
-    std::cout << "=== NFLC File Info ===\n";
-    std::cout << "File: " << inputFile << "\n";
-    std::cout << "File size: " << fileSize << " bytes\n";
-
-    uint32_t numBlocks = (fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    std::cout << "Number of blocks: " << numBlocks << "\n\n";
-
-    // Read first header for total sizes
-    NflcBlockHeader firstHdr;
-    ifs.read(reinterpret_cast<char*>(&firstHdr), sizeof(firstHdr));
-
-    if (std::memcmp(firstHdr.magic, "nFlC", 4) != 0) {
-        std::cerr << "Error: Not an NFLC file\n";
-        return 1;
-    }
-
-    std::cout << "Total uncompressed size: " << firstHdr.totalUncompSize << " bytes\n";
-    std::cout << "Total compressed size: " << firstHdr.totalZSize << " bytes\n\n";
-
-    // Scan all blocks
-    uint32_t totalBlockUncomp = 0;
-    for (uint32_t i = 0; i < numBlocks; i++) {
-        ifs.seekg(i * BLOCK_SIZE, std::ios::beg);
-
-        NflcBlockHeader hdr;
-        ifs.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
-
-        if (std::memcmp(hdr.magic, "nFlC", 4) != 0) {
-            std::cout << "Block " << i << ": Invalid header (not nFlC)\n";
-            continue;
-        }
-
-        printBlockHeader(hdr, i);
-        totalBlockUncomp += hdr.blockUncompSize;
-    }
-
-    std::cout << "\nSum of block uncompressed sizes: " << totalBlockUncomp << " bytes\n";
-
-    return 0;
-}
-
-int decompress(const std::string& inputFile, const std::string& outputFile) {
-    std::ifstream ifs(inputFile, std::ios::binary);
-    if (!ifs.is_open()) {
-        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
-        return 1;
-    }
-
-    // Initialize LZO
-    if (lzo_init() != LZO_E_OK) {
-        std::cerr << "Error: LZO initialization failed\n";
-        return 1;
-    }
-
-    // Get file size and calculate number of blocks
-    ifs.seekg(0, std::ios::end);
-    std::streamoff fileSize = ifs.tellg();
-    ifs.seekg(0, std::ios::beg);
-
-    uint32_t numBlocks = (fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
-
-    // Read first header to get total uncompressed size
-    NflcBlockHeader firstHdr;
-    ifs.read(reinterpret_cast<char*>(&firstHdr), sizeof(firstHdr));
-    ifs.seekg(0, std::ios::beg);
-
-    if (std::memcmp(firstHdr.magic, "nFlC", 4) != 0) {
-        std::cerr << "Error: Not an NFLC file\n";
-        return 1;
-    }
-
-    uint32_t totalUncompSize = firstHdr.totalUncompSize;
-    std::cout << "Decompressing " << inputFile << "...\n";
-    std::cout << "File size: " << fileSize << " bytes\n";
-    std::cout << "Number of blocks: " << numBlocks << "\n";
-    std::cout << "Expected uncompressed size: " << totalUncompSize << " bytes\n\n";
-
-    // Allocate output buffer
-    std::vector<unsigned char> outputData(totalUncompSize);
-    uint32_t currentOutOffset = 0;
-
-    // Process each block
-    for (uint32_t blockNum = 0; blockNum < numBlocks; blockNum++) {
-        std::streamoff blockOffset = blockNum * BLOCK_SIZE;
-        ifs.seekg(blockOffset, std::ios::beg);
-
-        // Read block header
-        NflcBlockHeader hdr;
-        ifs.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
-
-        if (std::memcmp(hdr.magic, "nFlC", 4) != 0) {
-            std::cerr << "Warning: Block " << blockNum << " has invalid header, skipping\n";
-            continue;
-        }
-
-        // Determine compressed data size for this block
-        uint32_t compSize = hdr.zsize;
-        uint32_t uncompSize = hdr.blockUncompSize;
-
-        if (uncompSize == 0) {
-            std::cout << "Block " << blockNum << ": Empty block, skipping\n";
-            continue;
-        }
-
-        // Read compressed data
-        std::vector<unsigned char> compData(compSize);
-        ifs.read(reinterpret_cast<char*>(compData.data()), compSize);
-
-        if (!ifs) {
-            std::streamsize bytesRead = ifs.gcount();
-            std::cerr << "Warning: Block " << blockNum << " - could only read "
-                << bytesRead << " of " << compSize << " bytes\n";
-            compSize = static_cast<uint32_t>(bytesRead);
-        }
-
-        // Decompress this block
-        lzo_uint outLen = uncompSize;
-
-        // Make sure we don't overflow output buffer
-        if (currentOutOffset + uncompSize > outputData.size()) {
-            std::cerr << "Error: Output buffer overflow at block " << blockNum << "\n";
-            break;
-        }
-
-        int result = lzo1x_decompress_safe(
-            compData.data(),
-            compSize,
-            outputData.data() + currentOutOffset,
-            &outLen,
-            nullptr
-        );
-
-        if (result != LZO_E_OK) {
-            // Try unsafe version
-            outLen = uncompSize;
-            result = lzo1x_decompress(
-                compData.data(),
-                compSize,
-                outputData.data() + currentOutOffset,
-                &outLen,
-                nullptr
-            );
-
-            if (result != LZO_E_OK) {
-                std::cerr << "Error: Block " << blockNum << " decompression failed (code " << result << ")\n";
-                return 1;
-            }
-        }
-
-        std::cout << "Block " << blockNum << ": " << compSize << " -> " << outLen << " bytes\n";
-        currentOutOffset += outLen;
-    }
-
-    std::cout << "\nTotal decompressed: " << currentOutOffset << " bytes\n";
-
-    // Write output
-    std::ofstream ofs(outputFile, std::ios::binary);
-    if (!ofs.is_open()) {
-        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
-        return 1;
-    }
-
-    ofs.write(reinterpret_cast<const char*>(outputData.data()), currentOutOffset);
-    ofs.close();
-
-    std::cout << "Successfully decompressed to: " << outputFile << "\n";
-    return 0;
-}
-
-int compress(const std::string& inputFile, const std::string& outputFile) {
-    std::ifstream ifs(inputFile, std::ios::binary);
-    if (!ifs.is_open()) {
-        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
-        return 1;
-    }
-
-    // Initialize LZO
-    if (lzo_init() != LZO_E_OK) {
-        std::cerr << "Error: LZO initialization failed\n";
-        return 1;
-    }
-
-    // Get input file size
-    ifs.seekg(0, std::ios::end);
-    std::streamoff inputSize = ifs.tellg();
-    ifs.seekg(0, std::ios::beg);
-
-    std::cout << "Compressing " << inputFile << " (" << inputSize << " bytes)...\n";
-
-    // Read entire input
-    std::vector<unsigned char> inputData(inputSize);
-    ifs.read(reinterpret_cast<char*>(inputData.data()), inputSize);
-    ifs.close();
-
-    // Determine block sizes
-    // Each block can hold up to (BLOCK_SIZE - HEADER_SIZE) bytes of compressed data
-    constexpr uint32_t MAX_COMPRESSED_PER_BLOCK = BLOCK_SIZE - HEADER_SIZE;
-
-    // We'll compress in chunks, targeting reasonable output chunks
-    // A good heuristic: input chunks of ~40KB often compress to <32KB
-    constexpr uint32_t TARGET_UNCOMP_CHUNK = 40960;  // 40KB chunks
-
-    // Calculate number of chunks we'll need
-    uint32_t numChunks = (inputSize + TARGET_UNCOMP_CHUNK - 1) / TARGET_UNCOMP_CHUNK;
-
-    // Prepare output file
-    std::ofstream ofs(outputFile, std::ios::binary);
-    if (!ofs.is_open()) {
-        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
-        return 1;
-    }
-
-    // Work memory for compression
-    std::vector<unsigned char> workMem(LZO1X_1_MEM_COMPRESS);
-
-    // Track cumulative offsets
-    uint32_t totalZSize = 0;
-    uint32_t prevZOffset = 0;
-    uint32_t prevUncompOffset = 0;
-
-    // First pass: compress all chunks and calculate total compressed size
-    struct ChunkInfo {
-        std::vector<unsigned char> compData;
-        uint32_t uncompSize;
-        uint32_t compSize;
-    };
-    std::vector<ChunkInfo> chunks;
-
-    uint32_t offset = 0;
-    while (offset < inputSize) {
-        uint32_t chunkSize = std::min(static_cast<uint32_t>(TARGET_UNCOMP_CHUNK),
-            static_cast<uint32_t>(inputSize - offset));
-
-        // Compress this chunk
-        size_t maxCompSize = chunkSize + chunkSize / 16 + 64 + 3;
-        std::vector<unsigned char> compData(maxCompSize);
-
-        lzo_uint compLen = maxCompSize;
-        int result = lzo1x_1_compress(
-            inputData.data() + offset,
-            chunkSize,
-            compData.data(),
-            &compLen,
-            workMem.data()
-        );
-
-        if (result != LZO_E_OK) {
-            std::cerr << "Error: Compression failed at offset " << offset << "\n";
-            return 1;
-        }
-
-        compData.resize(compLen);
-
-        ChunkInfo ci;
-        ci.compData = std::move(compData);
-        ci.uncompSize = chunkSize;
-        ci.compSize = static_cast<uint32_t>(compLen);
-
-        totalZSize += ci.compSize;
-        chunks.push_back(std::move(ci));
-
-        offset += chunkSize;
-    }
-
-    std::cout << "Compressed into " << chunks.size() << " blocks\n";
-    std::cout << "Total compressed size: " << totalZSize << " bytes\n";
-
-    // Second pass: write blocks
-    prevZOffset = 0;
-    prevUncompOffset = 0;
-
-    for (size_t i = 0; i < chunks.size(); i++) {
-        const ChunkInfo& ci = chunks[i];
-
-        // Prepare block header
-        NflcBlockHeader hdr;
-        std::memset(&hdr, 0, sizeof(hdr));
-
-        std::memcpy(hdr.magic, "nFlC", 4);
-        hdr.version = 0x0101;
-        hdr.blockIndex = static_cast<uint16_t>(i);
-        hdr.flags = 0x80000012;
-        hdr.flags2 = 0x80000080;
-        hdr.dummy1 = 0x0901;
-        hdr.zsize = static_cast<uint16_t>(std::min(ci.compSize, (uint32_t)0xFFFF));
-        hdr.checksum1 = 0xCB3E47E2;  // Placeholder
-        hdr.blockUncompSize = ci.uncompSize;
-        hdr.checksum2 = 0xA309C008;  // Placeholder
-        hdr.totalZSize = totalZSize;
-        hdr.prevZOffset = prevZOffset;
-        hdr.totalUncompSize = static_cast<uint32_t>(inputSize);
-        hdr.prevUncompOffset = prevUncompOffset;
-
-        // Write header
-        ofs.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
-
-        // Write compressed data
-        ofs.write(reinterpret_cast<const char*>(ci.compData.data()), ci.compSize);
-
-        // Pad to 32KB block boundary
-        std::streamoff currentPos = ofs.tellp();
-        std::streamoff blockEnd = ((currentPos + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
-
-        if (i < chunks.size() - 1) {  // Don't pad last block
-            std::streamoff paddingSize = blockEnd - currentPos;
-            std::vector<char> padding(paddingSize, 0);
-            ofs.write(padding.data(), paddingSize);
-        }
-
-        std::cout << "Block " << i << ": " << ci.uncompSize << " -> " << ci.compSize << " bytes\n";
-
-        prevZOffset += ci.compSize;
-        prevUncompOffset += ci.uncompSize;
-    }
-
-    ofs.close();
-
-    // Get final file size
-    std::ifstream checkSize(outputFile, std::ios::binary | std::ios::ate);
-    std::streamoff outputSize = checkSize.tellg();
-    checkSize.close();
-
-    std::cout << "\nSuccessfully compressed to: " << outputFile << "\n";
-    std::cout << "Output file size: " << outputSize << " bytes\n";
-    std::cout << "Compression ratio: " << std::fixed << std::setprecision(1)
-        << (100.0 * outputSize / inputSize) << "%\n";
-
-    return 0;
-}
-
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        printUsage(argv[0]);
-        return 1;
-    }
-
-    std::string mode = argv[1];
-
-    if (mode == "-d" || mode == "--decompress") {
-        if (argc < 4) {
-            std::cerr << "Error: Missing output file\n";
-            printUsage(argv[0]);
-            return 1;
-        }
-        return decompress(argv[2], argv[3]);
-    }
-    else if (mode == "-c" || mode == "--compress") {
-        if (argc < 4) {
-            std::cerr << "Error: Missing output file\n";
-            printUsage(argv[0]);
-            return 1;
-        }
-        return compress(argv[2], argv[3]);
-    }
-    else if (mode == "-i" || mode == "--info") {
-        return showInfo(argv[2]);
-    }
-    else {
-        std::cerr << "Error: Unknown mode '" << mode << "'\n";
-        printUsage(argv[0]);
-        return 1;
-    }
-}
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <stdexcept>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <chrono>
+#include <sstream>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "crc32c.h"
+#include "nflc.h"
+
+// Command line options shared by all modes
+struct Options {
+    unsigned threads = 1;       // -j N: worker threads (0 = one per hardware thread)
+    bool stream = false;        // --stream: bounded memory, writing blocks as they finish
+    bool pack = false;          // --pack: size each block's input so its payload fills the 32KB slot
+    uint32_t maxChunk = NFLC_DEFAULT_MAX_CHUNK;  // --max-chunk N: largest uncompressed block --pack may emit
+    bool split = false;         // --split: with --pack, end each block where the next one reaches furthest
+    int level = NFLC_DEFAULT_LEVEL;  // -1..-9, --level N|auto: LZO1X encoder level (NFLC_LEVEL_AUTO = best of several)
+    bool noSimd = false;        // --no-simd: decode with minilzo's lzo1x_decompress_safe
+    bool affinity = false;      // --affinity: pin each worker thread to its own CPU
+    bool trusted = false;       // --trusted: verify once, then decode with the unchecked decoder
+    bool recover = false;       // --recover: salvage a damaged archive, zero-filling what cannot be decoded
+    std::string range;          // -x offset:length: decompress only this byte range
+    std::string base;           // --base FILE: compress incrementally against this earlier archive
+    bool cache = false;         // --cache DIR / --cache-mem MB: reuse decoded blocks seen before
+    std::string cacheDir;       // empty: in-memory cache only
+    unsigned cacheMemMB = 256;
+    unsigned ioDepth = 4;       // --io-depth N: chunks the streaming modes keep in flight (0 = synchronous I/O)
+    bool direct = false;        // --direct: write output files past the OS cache
+    bool verify = false;        // --verify: decode every block as it is written and compare it with the input
+    std::vector<std::string> hot; // --hot PATTERN: -mc members to lay out first
+    std::string format = "text";  // --format text|json|csv: output of -i
+    bool stats = false;         // --stats[=FILE]: emit per-stage timings and counters as JSON
+    bool progress = false;      // --progress[=text|json]: report progress from a sampling thread
+    bool progressJson = false;
+    std::string statsPath;      // empty: JSON on stdout
+};
+
+unsigned resolveThreadCount(unsigned requested) {
+    if (requested == 0) {
+        requested = std::thread::hardware_concurrency();
+    }
+    return std::max(requested, 1u);
+}
+
+NflcCompressOptions compressOptions(const Options& opts) {
+    NflcCompressOptions co;
+    co.level = opts.level;
+    co.pack = opts.pack;
+    co.maxChunk = opts.maxChunk;
+    co.split = opts.split;
+    co.verify = opts.verify;
+    return co;
+}
+
+// Write a whole output file in one go, preallocated to its size
+bool writeOutputFile(const std::string& path, const unsigned char* data, size_t size, const Options& opts) {
+    NflcStageTimer timer(NflcStage::OutputWrite);
+    NflcFileSink sink;
+    return sink.open(path, opts.direct) && sink.reserve(size) && sink.write(data, size) && sink.close();
+}
+
+// Informational output: summaries go to infoLog(), per-block lines to blockLog(). Both are
+// stdout normally and stderr when stdout carries data; --stats silences them.
+std::ostream g_nullLog(nullptr);
+std::ostream* g_infoLog = &std::cout;
+std::ostream* g_blockLog = &std::cout;
+
+std::ostream& infoLog() { return *g_infoLog; }
+std::ostream& blockLog() { return *g_blockLog; }
+// Errors that follow from a cancel; main() reports the cancel itself, once
+std::ostream& errorLog() { return nflcProgress().cancelled() ? g_nullLog : std::cerr; }
+
+// The block cache asked for by --cache / --cache-mem, or null
+std::unique_ptr<NflcBlockCache> openBlockCache(const Options& opts) {
+    if (!opts.cache) {
+        return nullptr;
+    }
+    return std::make_unique<NflcBlockCache>(static_cast<size_t>(opts.cacheMemMB) * 1024 * 1024, opts.cacheDir);
+}
+
+void reportBlockCache(const NflcBlockCache* cache) {
+    if (cache != nullptr) {
+        infoLog() << "Block cache: " << cache->hits() << " of " << (cache->hits() + cache->misses())
+            << " blocks reused\n";
+    }
+}
+
+std::string jsonString(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+void writeStatsJson(std::ostream& os, const std::string& mode, const std::vector<std::string>& files,
+    unsigned threads, int exitCode, double wallSeconds) {
+    os << "{\n";
+    os << "  \"mode\": " << jsonString(mode) << ",\n";
+    os << "  \"files\": [";
+    for (size_t i = 0; i < files.size(); i++) {
+        os << (i ? ", " : "") << jsonString(files[i]);
+    }
+    os << "],\n";
+    os << "  \"threads\": " << threads << ",\n";
+    os << "  \"decoder\": " << jsonString(nflcDecoderName()) << ",\n";
+    os << "  \"crc32c\": " << jsonString(crc32cKernel()) << ",\n";
+    os << "  \"exit_code\": " << exitCode << ",\n";
+    os << "  \"wall_seconds\": " << std::fixed << std::setprecision(6) << wallSeconds << ",\n";
+    os << "  \"stage_seconds\": {";
+    for (size_t i = 0; i < static_cast<size_t>(NflcStage::Count); i++) {
+        os << (i ? ", " : "") << "\"" << NFLC_STAGE_NAMES[i] << "\": " << nflcStats().stageNanos[i].load() / 1e9;
+    }
+    os << "},\n";
+    os << "  \"counters\": {";
+    for (size_t i = 0; i < static_cast<size_t>(NflcCounter::Count); i++) {
+        os << (i ? ", " : "") << "\"" << NFLC_COUNTER_NAMES[i] << "\": " << nflcStats().counters[i].load();
+    }
+    os << "}\n";
+    os << "}\n";
+}
+
+// --progress: a thread that samples nflcProgress() at a fixed rate and shows one rolling status
+// line on stderr, or with --progress=json one event per line for a GUI to parse. The workers
+// only bump atomic counters, so a slow console never holds them up.
+class ProgressReporter {
+public:
+    static constexpr std::chrono::milliseconds INTERVAL{ 250 };
+
+    explicit ProgressReporter(bool json) : json_(json), start_(std::chrono::steady_clock::now()) {
+        thread_ = std::thread([this]() { run(); });
+    }
+    ~ProgressReporter() { stop(); }
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    // Stop sampling and report the final figures
+    void finish(int exitCode) {
+        stop();
+        report(true, exitCode);
+    }
+
+private:
+    void stop() {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!cv_.wait_for(lock, INTERVAL, [this]() { return stop_; })) {
+            report(false, 0);
+        }
+    }
+
+    void report(bool final, int exitCode) {
+        const NflcProgress& p = nflcProgress();
+        uint64_t bytes = p.bytes.load(std::memory_order_relaxed);
+        uint64_t blocks = p.blocks.load(std::memory_order_relaxed);
+        uint64_t total = p.totalBytes.load(std::memory_order_relaxed);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        double rate = seconds > 0 ? bytes / seconds : 0;
+        double eta = total > bytes && rate > 0 ? (total - bytes) / rate : 0;
+
+        // One write per update; stderr is unbuffered
+        std::ostringstream line;
+        line << std::fixed;
+        if (json_) {
+            line << "{\"event\": \"" << (final ? "done" : "progress") << "\", \"bytes\": " << bytes
+                << ", \"total_bytes\": " << total << ", \"blocks\": " << blocks << std::setprecision(3)
+                << ", \"elapsed_seconds\": " << seconds << ", \"bytes_per_second\": " << std::setprecision(0) << rate;
+            if (final) {
+                line << ", \"exit_code\": " << exitCode << ", \"cancelled\": " << (p.cancelled() ? "true" : "false");
+            }
+            else if (total > 0) {
+                line << std::setprecision(1) << ", \"eta_seconds\": " << eta;
+            }
+            line << "}\n";
+        }
+        else {
+            line << "\r" << std::setprecision(1);
+            if (total > 0) {
+                line << std::setw(5) << std::min(100.0, 100.0 * bytes / total) << "%  " << bytes / 1e6 << " / "
+                    << total / 1e6 << " MB";
+            }
+            else {
+                line << bytes / 1e6 << " MB";
+            }
+            line << ", " << blocks << " blocks, " << rate / 1e6 << " MB/s";
+            if (final) {
+                line << " in " << seconds << " s" << (p.cancelled() ? " (cancelled)" : "");
+            }
+            else if (total > 0) {
+                unsigned left = static_cast<unsigned>(eta + 0.5);
+                line << ", ETA " << left / 60 << ":" << std::setw(2) << std::setfill('0') << left % 60 << std::setfill(' ');
+            }
+            // Blank out whatever is left of a longer previous line
+            size_t width = static_cast<size_t>(line.tellp());
+            line << std::string(lastWidth_ > width ? lastWidth_ - width : 0, ' ') << (final ? "\n" : "");
+            lastWidth_ = width;
+        }
+        std::string text = line.str();
+        std::cerr.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    bool json_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    size_t lastWidth_ = 0;
+    std::thread thread_;
+};
+
+// The first Ctrl-C (or SIGTERM) cancels the job through nflcProgress(): workers stop at the
+// next block and the run exits with 130, deleting an archive it had only partly written.
+// A second Ctrl-C kills the process as usual.
+void handleInterrupt(int signal) {
+    nflcProgress().cancel();
+    std::signal(signal, SIG_DFL);
+}
+
+// --trusted: an archive is decoded with the checked decoder the first time, and once every
+// block has decoded cleanly a fingerprint of it (size, modification time, every slot header,
+// and the CRC-32C of every payload whose header carries no checksum) is stored next to it in
+// <archive>.verified. Later --trusted runs whose fingerprint still matches skip the bounds
+// checks; payloads with a checksum are still checked against it as they are decoded, so no
+// byte reaches the unchecked decoder that was not covered by the verification. Anything else
+// stays on the checked decoders.
+std::string verifyCachePath(const std::string& path) {
+    return path + ".verified";
+}
+
+uint64_t archiveFingerprint(const std::string& path, NflcByteSpan in) {
+    // FNV-1a, 64-bit
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto mix = [&hash](const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; i++) {
+            hash = (hash ^ p[i]) * 0x100000001B3ull;
+        }
+    };
+
+    std::error_code ec;
+    int64_t mtime = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    uint64_t size = in.size();
+    mix(&size, sizeof(size));
+    mix(&mtime, sizeof(mtime));
+    uint32_t numBlocks = nflcBlockCount(in.size());
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        size_t offset = static_cast<size_t>(i) * NFLC_BLOCK_SIZE;
+        mix(in.data() + offset, std::min<size_t>(NFLC_HEADER_SIZE, in.size() - offset));
+
+        // Payloads without a checksum of their own; the same bytes the decoder is given
+        NflcBlockHeader hdr;
+        if (nflcReadBlockHeader(in, i, hdr) && !nflcBlockCrc(hdr).present) {
+            size_t payload = offset + NFLC_HEADER_SIZE;
+            size_t compSize = std::min<size_t>(hdr.zsize, in.size() - std::min(payload, in.size()));
+            uint32_t payloadCrc = compSize > 0 ? crc32c(in.data() + payload, compSize) : 0;
+            mix(&payloadCrc, sizeof(payloadCrc));
+        }
+    }
+    return hash;
+}
+
+std::string fingerprintLine(const std::string& path, NflcByteSpan in) {
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "nFlC verified %016llx",
+        static_cast<unsigned long long>(archiveFingerprint(path, in)));
+    return buf;
+}
+
+// True if the archive at path (mapped as in) was verified and has not changed since
+bool isVerified(const std::string& path, NflcByteSpan in) {
+    std::ifstream ifs(verifyCachePath(path));
+    std::string line;
+    if (!std::getline(ifs, line) || line != fingerprintLine(path, in)) {
+        return false;
+    }
+    nflcStats().count(NflcCounter::VerifyCacheHits);
+    return true;
+}
+
+// Record that every block of the archive decoded with the checked decoder
+void markVerified(const std::string& path, NflcByteSpan in) {
+    std::ofstream ofs(verifyCachePath(path));
+    ofs << fingerprintLine(path, in) << "\n";
+    if (!ofs) {
+        std::cerr << "Warning: Cannot write verification cache: " << verifyCachePath(path) << "\n";
+    }
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "NFLC Multi-Block Compress/Decompress Tool for Ultimate Spider-Man\n";
+    std::cerr << "Usage:\n";
+    std::cerr << "  Decompress: " << programName << " -d input.nflc output.bin\n";
+    std::cerr << "  Compress:   " << programName << " -c input.bin output.nflc\n";
+    std::cerr << "  Info:       " << programName << " -i input.nflc [--format text|json|csv]\n";
+    std::cerr << "              Scan the block headers and check their offset chains; json and csv\n";
+    std::cerr << "              give one compact record per block for scripts\n";
+    std::cerr << "  Test:       " << programName << " -t input.nflc\n";
+    std::cerr << "              Decode every block and check its checksums, writing nothing\n";
+    std::cerr << "  Batch:      " << programName << " -bd|-bc <dir | dir/*.ext | manifest.txt> output_dir\n";
+    std::cerr << "              Decompress (-bd) or compress (-bc) many files on one worker pool\n";
+    std::cerr << "  Pack:       " << programName << " -mc <dir | dir/*.ext | manifest.txt> output.nflp [--hot PATTERN]...\n";
+    std::cerr << "              Compress many files into one pack of NFLC archives with a member\n";
+    std::cerr << "              table, members matching --hot first\n";
+    std::cerr << "  Unpack:     " << programName << " -mx input.nflp output_dir\n";
+    std::cerr << "  Benchmark:  " << programName << " --bench [corpus files...]\n";
+    std::cerr << "              Round-trip timings at 1, 2, 4, 8, 16, 24, 32, ... threads up to -j\n";
+    std::cerr << "              (default all cores)\n";
+    std::cerr << "Options:\n";
+    std::cerr << "  -j N        Use N worker threads (0 = all cores, default 1)\n";
+    std::cerr << "  --stream    Work with bounded memory, writing each block as it is finished\n";
+    std::cerr << "              (implied when input, or decompressed output, is '-' for stdin/stdout;\n";
+    std::cerr << "              compressed output must be a seekable file)\n";
+    std::cerr << "  --base OLD  Compress: reuse the blocks of archive OLD whose data is unchanged\n";
+    std::cerr << "              and recompress only the rest (not with --stream)\n";
+    std::cerr << "  --cache DIR Decompress: keep decoded blocks in DIR and copy any block whose\n";
+    std::cerr << "              payload was decoded before instead of decoding it again\n";
+    std::cerr << "  --cache-mem MB  In-memory part of the block cache (default 256; alone, the\n";
+    std::cerr << "              cache is not kept across runs)\n";
+    std::cerr << "  --io-depth N  Streaming: read up to N 1MB chunks ahead and write behind on\n";
+    std::cerr << "              background threads, overlapping I/O with (de)compression\n";
+    std::cerr << "              (default 4, 0 = synchronous)\n";
+    std::cerr << "  --direct    Write output files past the OS cache (O_DIRECT / unbuffered), for\n";
+    std::cerr << "              outputs too large to be worth caching (not for '-' output)\n";
+    std::cerr << "  -x OFF:LEN  Decompress: extract only LEN bytes starting at OFF, decoding just\n";
+    std::cerr << "              the blocks that overlap the range (decimal, or hex with 0x)\n";
+    std::cerr << "  --stats[=FILE]  Print per-stage timings and counters as JSON at exit (to FILE\n";
+    std::cerr << "              if given) instead of per-block output\n";
+    std::cerr << "  --progress[=text|json]  Instead of per-block output, show a rolling line with\n";
+    std::cerr << "              MB/s and ETA on stderr, or (json) one event per line for a GUI;\n";
+    std::cerr << "              Ctrl-C cancels between blocks and exits with 130, deleting a partly\n";
+    std::cerr << "              written archive\n";
+    std::cerr << "  --verify    Compress: decode every block on background threads as it is written\n";
+    std::cerr << "              and compare it with the input, stopping at the first bad block\n";
+    std::cerr << "  --pack      Compress: grow each block's input until its payload fills the slot\n";
+    std::cerr << "  --max-chunk N  Largest uncompressed block size --pack may use (1 to "
+        << NFLC_PACK_REGION_SIZE << ", default " << NFLC_DEFAULT_MAX_CHUNK << ")\n";
+    std::cerr << "  --split     With --pack: try a few shorter ends for each block and keep the one\n";
+    std::cerr << "              the next block reaches furthest from (several times slower to compress)\n";
+    std::cerr << "  --affinity  Pin each worker thread to its own CPU, keeping its blocks and the\n";
+    std::cerr << "              output pages it writes on one NUMA node\n";
+    std::cerr << "  --no-simd   Decompress with the reference miniLZO decoder instead of the\n";
+    std::cerr << "              vectorised one (AVX2/SSE2/NEON, picked at runtime)\n";
+    std::cerr << "  --trusted   Decompress: check the archive once with the safe decoder, record it\n";
+    std::cerr << "              in <input>.verified and use the faster unchecked decoder while it\n";
+    std::cerr << "              is unchanged (not for streamed input)\n";
+    std::cerr << "  --recover   Decompress a damaged archive: resync on the next nFlC header after\n";
+    std::cerr << "              bad data, place each good block at its own offset, zero-fill the\n";
+    std::cerr << "              rest and list the damaged ranges (output is written; exit code 1\n";
+    std::cerr << "              if anything was lost)\n";
+    std::cerr << "  -1 .. -9, --level N|auto  Compress: LZO1X level (1 = fast LZO1X-1, default;\n";
+    std::cerr << "              2-9 = high-ratio optimal parse, slower; auto = each block at 1, 5 and 9,\n";
+    std::cerr << "              keeping the one that fits the most input in its slot, the smaller\n";
+    std::cerr << "              payload on a tie)\n";
+}
+
+void printBlockHeader(const NflcBlockHeader& hdr, uint32_t blockNum) {
+    blockLog() << "--- Block " << blockNum << " ---\n";
+    blockLog() << "  Block Index: " << hdr.blockIndex << "\n";
+    blockLog() << "  Compressed size (zsize): " << hdr.zsize << " bytes\n";
+    blockLog() << "  Block uncompressed size: " << hdr.blockUncompSize << " bytes\n";
+    blockLog() << "  Prev Z offset: " << hdr.prevZOffset << "\n";
+    blockLog() << "  Prev uncomp offset: " << hdr.prevUncompOffset << "\n";
+    NflcBlockCrc crc = nflcBlockCrc(hdr);
+    if (crc.present) {
+        blockLog() << "  CRC-32C payload / data: " << std::hex << std::setfill('0') << std::setw(8) << crc.payload
+            << " / " << std::setw(8) << crc.data << std::dec << std::setfill(' ') << "\n";
+    }
+}
+
+// Problem bits of one slot (or the whole scan) as names joined by sep, empty if none
+std::string scanProblems(uint32_t problems, const char* sep) {
+    std::string out;
+    for (uint32_t bit = 0; bit < 6; bit++) {
+        if (problems & (1u << bit)) {
+            out += (out.empty() ? "" : sep);
+            out += NFLC_SCAN_PROBLEM_NAMES[bit];
+        }
+    }
+    return out;
+}
+
+double blockRatio(const NflcBlockHeader& hdr) {
+    return hdr.blockUncompSize ? static_cast<double>(hdr.zsize) / hdr.blockUncompSize : 0.0;
+}
+
+void printInfoJson(const std::string& inputFile, size_t fileSize, const NflcScan& scan) {
+    std::ostream& os = std::cout;
+    os << "{\"file\": " << jsonString(inputFile) << ", \"file_size\": " << fileSize
+        << ", \"slots\": " << scan.slots.size() << ", \"blocks\": " << scan.validBlocks
+        << ", \"total_uncomp_size\": " << scan.totalUncompSize << ", \"total_zsize\": " << scan.totalZSize
+        << ", \"sum_uncomp_size\": " << scan.sumUncompSize << ", \"sum_zsize\": " << scan.sumZSize
+        << ", \"padding_bytes\": " << scan.paddingBytes << ", \"consistent\": " << (scan.problems ? "false" : "true")
+        << ", \"problems\": [";
+    std::string problems = scanProblems(scan.problems, "\", \"");
+    os << (problems.empty() ? "" : "\"" + problems + "\"") << "],\n \"block_list\": [";
+    os << std::fixed << std::setprecision(4);
+    for (size_t i = 0; i < scan.slots.size(); i++) {
+        const NflcSlotInfo& info = scan.slots[i];
+        const NflcBlockHeader& hdr = info.hdr;
+        os << (i ? ",\n  " : "\n  ") << "{\"slot\": " << info.slot;
+        if (!(info.problems & NFLC_SCAN_BAD_MAGIC)) {
+            os << ", \"index\": " << hdr.blockIndex << ", \"zsize\": " << hdr.zsize
+                << ", \"uncomp_size\": " << hdr.blockUncompSize << ", \"prev_zoffset\": " << hdr.prevZOffset
+                << ", \"prev_uncomp_offset\": " << hdr.prevUncompOffset << ", \"ratio\": " << blockRatio(hdr)
+                << ", \"crc\": " << (nflcBlockCrc(hdr).present ? "true" : "false");
+        }
+        os << ", \"padding\": " << info.padding << ", \"problems\": [";
+        problems = scanProblems(info.problems, "\", \"");
+        os << (problems.empty() ? "" : "\"" + problems + "\"") << "]}";
+    }
+    os << "\n]}\n";
+}
+
+void printInfoCsv(const NflcScan& scan) {
+    std::ostream& os = std::cout;
+    os << "slot,valid,index,zsize,uncomp_size,prev_zoffset,prev_uncomp_offset,ratio,padding,crc,problems\n";
+    os << std::fixed << std::setprecision(4);
+    for (const NflcSlotInfo& info : scan.slots) {
+        const NflcBlockHeader& hdr = info.hdr;
+        bool valid = !(info.problems & NFLC_SCAN_BAD_MAGIC);
+        os << info.slot << "," << valid << "," << hdr.blockIndex << "," << hdr.zsize << "," << hdr.blockUncompSize
+            << "," << hdr.prevZOffset << "," << hdr.prevUncompOffset << "," << blockRatio(hdr) << "," << info.padding
+            << "," << nflcBlockCrc(hdr).present << "," << scanProblems(info.problems, ";") << "\n";
+    }
+}
+
+// -i on a pack: the member table
+int showPackInfo(const std::string& inputFile, const Options& opts) {
+    NflcPackReader pack;
+    if (!pack.open(inputFile)) {
+        std::cerr << "Error: " << pack.error() << "\n";
+        return 1;
+    }
+    const std::vector<NflcPackReader::Member>& members = pack.members();
+
+    if (opts.format == "json") {
+        std::cout << "{\"file\": " << jsonString(inputFile) << ", \"members\": " << members.size()
+            << ", \"hot_offset\": " << pack.hotOffset() << ", \"hot_bytes\": " << pack.hotData().size()
+            << ", \"member_list\": [";
+        for (size_t i = 0; i < members.size(); i++) {
+            const NflcPackReader::Member& m = members[i];
+            std::cout << (i ? ",\n  " : "\n  ") << "{\"name\": " << jsonString(m.name) << ", \"offset\": " << m.offset
+                << ", \"size\": " << m.size << ", \"uncomp_size\": " << m.uncompSize
+                << ", \"hot\": " << (m.hot ? "true" : "false") << "}";
+        }
+        std::cout << "\n]}\n";
+        return 0;
+    }
+    if (opts.format == "csv") {
+        std::cout << "name,offset,size,uncomp_size,hot\n";
+        for (const NflcPackReader::Member& m : members) {
+            std::cout << m.name << "," << m.offset << "," << m.size << "," << m.uncompSize << "," << m.hot << "\n";
+        }
+        return 0;
+    }
+
+    infoLog() << "=== NFLC Pack Info ===\n";
+    infoLog() << "File: " << inputFile << "\n";
+    infoLog() << "Members: " << members.size() << "\n";
+    infoLog() << "Hot members: " << pack.hotData().size() << " bytes from offset " << pack.hotOffset() << "\n\n";
+    for (const NflcPackReader::Member& m : members) {
+        blockLog() << (m.hot ? "* " : "  ") << m.name << ": offset " << m.offset << ", " << m.size
+            << " -> " << m.uncompSize << " bytes\n";
+    }
+    return 0;
+}
+
+int showInfo(const std::string& inputFile, const Options& opts) {
+    NflcMappedFile in;
+    if (!in.open(inputFile)) {
+        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+        return 1;
+    }
+
+    if (nflcIsPack(in.view())) {
+        return showPackInfo(inputFile, opts);
+    }
+
+    // All headers are read in one pass over the mapping; nothing is decoded
+    size_t fileSize = in.size();
+    NflcScan scan;
+    if (!nflcScanArchive(in.view(), scan)) {
+        std::cerr << "Error: Not an NFLC file\n";
+        return 1;
+    }
+
+    if (opts.format == "json") {
+        printInfoJson(inputFile, fileSize, scan);
+        return 0;
+    }
+    if (opts.format == "csv") {
+        printInfoCsv(scan);
+        return 0;
+    }
+
+    infoLog() << "=== NFLC File Info ===\n";
+    infoLog() << "File: " << inputFile << "\n";
+    infoLog() << "File size: " << fileSize << " bytes\n";
+    infoLog() << "Number of blocks: " << scan.slots.size() << "\n\n";
+
+    infoLog() << "Total uncompressed size: " << scan.totalUncompSize << " bytes\n";
+    infoLog() << "Total compressed size: " << scan.totalZSize << " bytes\n\n";
+
+    for (const NflcSlotInfo& info : scan.slots) {
+        if (info.problems & NFLC_SCAN_BAD_MAGIC) {
+            blockLog() << "Block " << info.slot << ": Invalid header (not nFlC)\n";
+            continue;
+        }
+        printBlockHeader(info.hdr, info.slot);
+        blockLog() << "  Padding: " << info.padding << " bytes\n";
+        if (info.problems) {
+            blockLog() << "  Problems: " << scanProblems(info.problems, ", ") << "\n";
+        }
+    }
+
+    infoLog() << "\nSum of block uncompressed sizes: " << scan.sumUncompSize << " bytes\n";
+    infoLog() << "Sum of block compressed sizes: " << scan.sumZSize << " bytes\n";
+    infoLog() << "Padding: " << scan.paddingBytes << " bytes ("
+        << std::fixed << std::setprecision(1) << (fileSize ? 100.0 * scan.paddingBytes / fileSize : 0.0)
+        << std::defaultfloat << "% of the file)\n";
+    if (scan.problems) {
+        infoLog() << "Header chain: inconsistent (" << scanProblems(scan.problems, ", ") << ")\n";
+    }
+    else {
+        infoLog() << "Header chain: consistent\n";
+    }
+
+    return 0;
+}
+
+int decompress(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    NflcMappedFile in;
+    if (!in.open(inputFile)) {
+        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+        return 1;
+    }
+
+    // Initialize LZO
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    // Get file size and calculate number of blocks
+    size_t fileSize = in.size();
+    uint32_t numBlocks = nflcBlockCount(fileSize);
+
+    // Read first header to get total uncompressed size
+    NflcBlockHeader firstHdr;
+    if (!nflcReadBlockHeader(in.view(), 0, firstHdr)) {
+        std::cerr << "Error: Not an NFLC file\n";
+        return 1;
+    }
+
+    uint32_t totalUncompSize = firstHdr.totalUncompSize;
+    nflcProgress().expect(totalUncompSize);
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    infoLog() << "Decompressing " << inputFile << "...\n";
+    infoLog() << "File size: " << fileSize << " bytes\n";
+    infoLog() << "Number of blocks: " << numBlocks << "\n";
+    infoLog() << "Expected uncompressed size: " << totalUncompSize << " bytes\n";
+    infoLog() << "Worker threads: " << numThreads << "\n";
+    bool trusted = opts.trusted && isVerified(inputFile, in.view());
+    if (opts.trusted) {
+        infoLog() << (trusted ? "Archive verified, using the unchecked decoder\n" : "Verifying archive with the checked decoder\n");
+    }
+    infoLog() << "\n";
+
+    // Allocate output buffer, uninitialised: every page is first touched by the worker that
+    // decodes into it, which places it on that worker's NUMA node
+    std::unique_ptr<unsigned char[]> outputBuffer = std::make_unique_for_overwrite<unsigned char[]>(totalUncompSize);
+    std::span<unsigned char> outputData(outputBuffer.get(), totalUncompSize);
+
+    // Every header carries its own output offset, so blocks are decoded straight into
+    // their slice of outputData in any order. Results are reported afterwards in block order.
+    std::vector<NflcSlotResult> results(numBlocks);
+    std::unique_ptr<NflcBlockCache> cache = openBlockCache(opts);
+
+    nflcParallelFor(numBlocks, numThreads, [&](uint32_t blockNum, unsigned) {
+        nflcDecodeSlot(in.view(), blockNum, outputData, results[blockNum], trusted, cache.get());
+    });
+    nflcZeroUnwritten(outputData, results);
+
+    size_t totalDecompressed = 0;
+    size_t outputEnd = 0;
+    bool allDecoded = true;
+    for (uint32_t blockNum = 0; blockNum < numBlocks; blockNum++) {
+        const NflcSlotResult& res = results[blockNum];
+
+        if (res.status == NflcSlotStatus::BadMagic) {
+            std::cerr << "Warning: Block " << blockNum << " has invalid header, skipping\n";
+            continue;
+        }
+        if (res.status == NflcSlotStatus::Empty) {
+            blockLog() << "Block " << blockNum << ": Empty block, skipping\n";
+            continue;
+        }
+        if (res.status == NflcSlotStatus::Overflow) {
+            std::cerr << "Error: Output buffer overflow at block " << blockNum << "\n";
+            allDecoded = false;
+            break;
+        }
+        if (res.bytesRead < res.compSize) {
+            std::cerr << "Warning: Block " << blockNum << " - could only read "
+                << res.bytesRead << " of " << res.compSize << " bytes\n";
+        }
+        if (res.status == NflcSlotStatus::Failed) {
+            errorLog() << "Error: Block " << blockNum << " " << nflcErrorText(res.lzoResult) << "\n";
+            return 1;
+        }
+
+        blockLog() << "Block " << blockNum << ": " << std::min(res.compSize, res.bytesRead) << " -> " << res.outLen << " bytes\n";
+        totalDecompressed += res.outLen;
+        outputEnd = std::max<size_t>(outputEnd, res.outOffset + res.outLen);
+    }
+
+    infoLog() << "\nTotal decompressed: " << totalDecompressed << " bytes\n";
+    reportBlockCache(cache.get());
+
+    // Write output
+    if (!writeOutputFile(outputFile, outputData.data(), outputEnd, opts)) {
+        std::cerr << "Error: Cannot write output file: " << outputFile << "\n";
+        return 1;
+    }
+
+    if (opts.trusted && !trusted && allDecoded) {
+        markVerified(inputFile, in.view());
+    }
+
+    infoLog() << "Successfully decompressed to: " << outputFile << "\n";
+    return 0;
+}
+
+// Open path for binary output, or stdout for "-"
+std::ostream* openOutput(const std::string& path, std::ofstream& ofs) {
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return &std::cout;
+    }
+    ofs.open(path, std::ios::binary);
+    return ofs.is_open() ? &ofs : nullptr;
+}
+
+// Background I/O for the streaming modes. ReadAhead reads the input on its own thread, up to
+// depth chunks ahead of the consumer, and WriteBehind queues output for a thread that writes
+// it while the workers decode the next batch, so the disk (or network mount) and the CPU are
+// busy at the same time. With depth 0 both fall through to the stream on the calling thread.
+constexpr size_t IO_CHUNK_BYTES = 1024 * 1024;
+
+class ReadAhead {
+public:
+    ReadAhead(std::istream& in, unsigned depth) : in_(in), depth_(depth) {
+        if (depth_ > 0) {
+            thread_ = std::thread([this]() { run(); });
+        }
+    }
+    ~ReadAhead() {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+    }
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    // Like istream::read: fewer than len bytes are returned only at the end of the input
+    size_t read(unsigned char* dst, size_t len) {
+        if (depth_ == 0) {
+            NflcStageTimer timer(NflcStage::IoRead);
+            in_.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(len));
+            bad_ = in_.bad();
+            return static_cast<size_t>(in_.gcount());
+        }
+
+        size_t copied = 0;
+        while (copied < len) {
+            if (pos_ == current_.size()) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (current_.capacity() > 0) {
+                    spare_.push_back(std::move(current_));
+                    current_ = std::vector<unsigned char>();
+                    cv_.notify_all();
+                }
+                cv_.wait(lock, [this]() { return !ready_.empty() || done_; });
+                if (ready_.empty()) {
+                    break;
+                }
+                current_ = std::move(ready_.front());
+                ready_.pop_front();
+                pos_ = 0;
+            }
+            size_t n = std::min(len - copied, current_.size() - pos_);
+            std::memcpy(dst + copied, current_.data() + pos_, n);
+            pos_ += n;
+            copied += n;
+        }
+        return copied;
+    }
+
+    // The input stream failed (rather than ending); valid once read() has come up short
+    bool bad() const { return bad_; }
+
+private:
+    void run() {
+        for (;;) {
+            std::vector<unsigned char> chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stop_ || ready_.size() < depth_; });
+                if (stop_) {
+                    return;
+                }
+                if (!spare_.empty()) {
+                    chunk = std::move(spare_.back());
+                    spare_.pop_back();
+                }
+            }
+
+            chunk.resize(IO_CHUNK_BYTES);
+            size_t got;
+            {
+                NflcStageTimer timer(NflcStage::IoRead);
+                in_.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+                got = static_cast<size_t>(in_.gcount());
+            }
+            chunk.resize(got);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (got > 0) {
+                ready_.push_back(std::move(chunk));
+            }
+            if (got < IO_CHUNK_BYTES) {
+                bad_ = in_.bad();
+                done_ = true;
+            }
+            cv_.notify_all();
+            if (done_) {
+                return;
+            }
+        }
+    }
+
+    std::istream& in_;
+    unsigned depth_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<unsigned char>> ready_;     // chunks read, in input order
+    std::vector<std::vector<unsigned char>> spare_;    // consumed chunks, for reuse
+    std::vector<unsigned char> current_;               // chunk being handed out by read()
+    size_t pos_ = 0;
+    bool done_ = false;
+    bool stop_ = false;
+    bool bad_ = false;
+    std::thread thread_;
+};
+
+class WriteBehind {
+public:
+    WriteBehind(std::ostream& out, unsigned depth) : out_(out), depth_(depth) {
+        if (depth_ > 0) {
+            thread_ = std::thread([this]() { run(); });
+        }
+    }
+    ~WriteBehind() { finish(); }
+    WriteBehind(const WriteBehind&) = delete;
+    WriteBehind& operator=(const WriteBehind&) = delete;
+
+    void write(const void* data, size_t len) {
+        if (depth_ == 0) {
+            NflcStageTimer timer(NflcStage::OutputWrite);
+            out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(len));
+            return;
+        }
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        while (len > 0) {
+            if (current_.capacity() < IO_CHUNK_BYTES) {
+                current_.reserve(IO_CHUNK_BYTES);
+            }
+            size_t n = std::min(len, IO_CHUNK_BYTES - current_.size());
+            current_.insert(current_.end(), p, p + n);
+            p += n;
+            len -= n;
+            if (current_.size() == IO_CHUNK_BYTES) {
+                submit();
+            }
+        }
+    }
+
+    // False once a write has failed
+    bool ok() {
+        if (depth_ == 0) {
+            return static_cast<bool>(out_);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !failed_;
+    }
+
+    // Write out everything queued and flush the stream
+    bool finish() {
+        if (thread_.joinable()) {
+            if (!current_.empty()) {
+                submit();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+        NflcStageTimer timer(NflcStage::OutputWrite);
+        out_.flush();
+        return ok() && static_cast<bool>(out_);
+    }
+
+private:
+    // Queue the current chunk, waiting while depth chunks are already queued
+    void submit() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return queued_.size() < depth_; });
+        queued_.push_back(std::move(current_));
+        current_ = std::vector<unsigned char>();
+        if (!spare_.empty()) {
+            current_ = std::move(spare_.back());
+            spare_.pop_back();
+        }
+        cv_.notify_all();
+    }
+
+    void run() {
+        for (;;) {
+            std::vector<unsigned char> chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stop_ || !queued_.empty(); });
+                if (queued_.empty()) {
+                    return;
+                }
+                chunk = std::move(queued_.front());
+                queued_.pop_front();
+                cv_.notify_all();
+            }
+
+            bool written;
+            {
+                NflcStageTimer timer(NflcStage::OutputWrite);
+                written = static_cast<bool>(out_.write(reinterpret_cast<const char*>(chunk.data()),
+                    static_cast<std::streamsize>(chunk.size())));
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed_ = failed_ || !written;
+            chunk.clear();
+            spare_.push_back(std::move(chunk));
+        }
+    }
+
+    std::ostream& out_;
+    unsigned depth_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<unsigned char>> queued_;    // full chunks waiting to be written
+    std::vector<std::vector<unsigned char>> spare_;    // written chunks, for reuse
+    std::vector<unsigned char> current_;               // chunk being filled by write()
+    bool stop_ = false;
+    bool failed_ = false;
+    std::thread thread_;
+};
+
+// Streaming decompression: slots are read sequentially from any stream (stdin included),
+// decoded a window at a time and written out in block order, so memory stays bounded to a
+// few blocks no matter how large the archive is.
+int decompressStream(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    bool useStdin = (inputFile == "-");
+    bool useStdout = (outputFile == "-");
+
+    std::ifstream ifs;
+    if (useStdin) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+    else {
+        ifs.open(inputFile, std::ios::binary);
+        if (!ifs.is_open()) {
+            std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+            return 1;
+        }
+    }
+    std::istream& in = useStdin ? std::cin : ifs;
+
+    std::ofstream ofs;
+    std::ostream* outStream = openOutput(outputFile, ofs);
+    if (outStream == nullptr) {
+        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
+        return 1;
+    }
+    WriteBehind out(*outStream, opts.ioDepth);
+    ReadAhead reader(in, opts.ioDepth);
+
+    // Initialize LZO
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    if (opts.trusted) {
+        std::cerr << "Warning: --trusted needs a seekable archive; streamed blocks use the checked decoder\n";
+    }
+
+    // A payload may run past the end of its own slot (zsize can be up to 0xFFFF), so the
+    // window keeps enough trailing slots buffered to finish the last block of every batch.
+    constexpr uint32_t LOOKAHEAD_SLOTS = (0xFFFF + NFLC_HEADER_SIZE + NFLC_BLOCK_SIZE - 1) / NFLC_BLOCK_SIZE;
+    const uint32_t batchSlots = numThreads * 2;
+    std::vector<unsigned char> window(static_cast<size_t>(batchSlots + LOOKAHEAD_SLOTS) * NFLC_BLOCK_SIZE);
+    size_t windowFill = 0;
+    bool inputDone = false;
+
+    auto fillWindow = [&]() {
+        if (windowFill < window.size() && !inputDone) {
+            size_t want = window.size() - windowFill;
+            size_t got = reader.read(window.data() + windowFill, want);
+            windowFill += got;
+            inputDone = got < want;
+        }
+    };
+
+    struct StreamBlock {
+        NflcBlockHeader hdr;
+        bool valid = false;
+        uint32_t compSize = 0;
+        std::vector<unsigned char> outData;
+        size_t outLen = 0;
+        int lzoResult = NFLC_OK;
+    };
+    std::vector<StreamBlock> batch(batchSlots);
+
+    infoLog() << "Decompressing " << (useStdin ? "<stdin>" : inputFile) << " (streaming)...\n";
+    infoLog() << "Worker threads: " << numThreads << "\n\n";
+
+    fillWindow();
+
+    uint32_t totalUncompSize = 0;
+    uint64_t written = 0;
+    uint32_t blockBase = 0;
+    bool first = true;
+
+    while (windowFill > 0) {
+        uint32_t slotsInBatch = std::min<uint32_t>(batchSlots,
+            static_cast<uint32_t>((windowFill + NFLC_BLOCK_SIZE - 1) / NFLC_BLOCK_SIZE));
+
+        // Parse headers and size the per-slot output buffers
+        for (uint32_t i = 0; i < slotsInBatch; i++) {
+            StreamBlock& blk = batch[i];
+            size_t slotOffset = static_cast<size_t>(i) * NFLC_BLOCK_SIZE;
+            blk.valid = windowFill - slotOffset >= NflcCodec::HEADER_SIZE &&
+                NflcCodec::loadHeader(window.data() + slotOffset, blk.hdr);
+            if (!blk.valid) {
+                if (blockBase + i == 0) {
+                    std::cerr << "Error: Not an NFLC file\n";
+                    return 1;
+                }
+                continue;
+            }
+
+            if (first) {
+                totalUncompSize = blk.hdr.totalUncompSize;
+                nflcProgress().expect(totalUncompSize);
+                infoLog() << "Expected uncompressed size: " << totalUncompSize << " bytes\n\n";
+                first = false;
+            }
+
+            size_t available = windowFill - slotOffset - NFLC_HEADER_SIZE;
+            blk.compSize = std::min<uint32_t>(blk.hdr.zsize, static_cast<uint32_t>(available));
+
+            // Both sizes come from the header, so neither bounds the other; the payload does
+            if (blk.hdr.blockUncompSize > nflcMaxDecodedSize(blk.hdr.zsize)) {
+                std::cerr << "Error: Block " << blockBase + i << " claims " << blk.hdr.blockUncompSize
+                    << " bytes from a " << blk.hdr.zsize << "-byte payload\n";
+                return 1;
+            }
+            if (blk.hdr.blockUncompSize > totalUncompSize) {
+                std::cerr << "Error: Output buffer overflow at block " << blockBase + i << "\n";
+                return 1;
+            }
+            blk.outData.resize(blk.hdr.blockUncompSize);
+        }
+
+        // Decode the batch
+        nflcParallelFor(slotsInBatch, numThreads, [&](uint32_t i, unsigned) {
+            StreamBlock& blk = batch[i];
+            if (!blk.valid || blk.hdr.blockUncompSize == 0) {
+                return;
+            }
+            const unsigned char* compData = window.data() + static_cast<size_t>(i) * NFLC_BLOCK_SIZE + NFLC_HEADER_SIZE;
+            blk.outLen = blk.hdr.blockUncompSize;
+            blk.lzoResult = nflcDecodePayload(compData, blk.compSize, blk.outData.data(), blk.outLen, nflcBlockCrc(blk.hdr), false);
+        });
+
+        // Write the batch in block order
+        for (uint32_t i = 0; i < slotsInBatch; i++) {
+            StreamBlock& blk = batch[i];
+            uint32_t blockNum = blockBase + i;
+
+            if (!blk.valid) {
+                std::cerr << "Warning: Block " << blockNum << " has invalid header, skipping\n";
+                continue;
+            }
+            if (blk.hdr.blockUncompSize == 0) {
+                blockLog() << "Block " << blockNum << ": Empty block, skipping\n";
+                continue;
+            }
+            if (blk.compSize < blk.hdr.zsize) {
+                std::cerr << "Warning: Block " << blockNum << " - could only read "
+                    << blk.compSize << " of " << blk.hdr.zsize << " bytes\n";
+            }
+            if (blk.lzoResult != NFLC_OK) {
+                errorLog() << "Error: Block " << blockNum << " " << nflcErrorText(blk.lzoResult) << "\n";
+                return 1;
+            }
+
+            // Output can only move forward on a pipe: gaps are zero-filled, overlaps are fatal
+            if (blk.hdr.prevUncompOffset < written) {
+                std::cerr << "Error: Block " << blockNum << " overlaps data already written\n";
+                return 1;
+            }
+            static const char zeros[NFLC_BLOCK_SIZE] = {};
+            while (written < blk.hdr.prevUncompOffset) {
+                size_t gap = static_cast<size_t>(std::min<uint64_t>(blk.hdr.prevUncompOffset - written, sizeof(zeros)));
+                out.write(zeros, gap);
+                written += gap;
+            }
+
+            out.write(blk.outData.data(), blk.outLen);
+            written += blk.outLen;
+
+            blockLog() << "Block " << blockNum << ": " << blk.compSize << " -> " << blk.outLen << " bytes\n";
+        }
+
+        if (!out.ok()) {
+            std::cerr << "Error: Failed writing output\n";
+            return 1;
+        }
+
+        // Slide the window: keep the look-ahead slots, then top it up from the input
+        size_t consumed = std::min(windowFill, static_cast<size_t>(slotsInBatch) * NFLC_BLOCK_SIZE);
+        std::memmove(window.data(), window.data() + consumed, windowFill - consumed);
+        windowFill -= consumed;
+        blockBase += slotsInBatch;
+        fillWindow();
+    }
+
+    if (reader.bad()) {
+        std::cerr << "Error: Failed reading input\n";
+        return 1;
+    }
+    if (first) {
+        std::cerr << "Error: Not an NFLC file\n";
+        return 1;
+    }
+
+    if (!out.finish()) {
+        std::cerr << "Error: Failed writing output\n";
+        return 1;
+    }
+    infoLog() << "\nTotal decompressed: " << written << " bytes\n";
+    if (!useStdout) {
+        infoLog() << "Successfully decompressed to: " << outputFile << "\n";
+    }
+    return 0;
+}
+
+// One field of -x: decimal, or hex with a 0x prefix, and nothing else around it
+bool parseRangeField(std::string_view text, uint64_t& value) {
+    int base = 10;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        text.remove_prefix(2);
+        base = 16;
+    }
+    const char* end = text.data() + text.size();
+    std::from_chars_result r = std::from_chars(text.data(), end, value, base);
+    return r.ec == std::errc() && r.ptr == end;
+}
+
+// -x offset:length: decompress only the blocks overlapping one byte range of the output
+int extractRange(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    std::string_view range = opts.range;
+    size_t colon = range.find(':');
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    if (colon == std::string_view::npos || !parseRangeField(range.substr(0, colon), offset) ||
+        !parseRangeField(range.substr(colon + 1), length)) {
+        std::cerr << "Error: Invalid range '" << opts.range << "' (expected offset:length)\n";
+        return 1;
+    }
+
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    NflcReader reader;
+    if (!reader.open(inputFile)) {
+        std::cerr << "Error: " << reader.error() << "\n";
+        return 1;
+    }
+
+    if (offset > reader.totalUncompSize()) {
+        std::cerr << "Error: Range starts past the end of the data (" << reader.totalUncompSize() << " bytes)\n";
+        return 1;
+    }
+    if (length > reader.totalUncompSize() - offset) {
+        length = reader.totalUncompSize() - offset;
+        std::cerr << "Warning: Range truncated to " << length << " bytes\n";
+    }
+    nflcProgress().expect(length);
+
+    // --trusted verifies the whole archive once, up front, so later extracts skip the checks
+    if (opts.trusted) {
+        if (isVerified(inputFile, reader.view())) {
+            infoLog() << "Archive verified, using the unchecked decoder\n";
+        }
+        else {
+            infoLog() << "Verifying archive with the checked decoder\n";
+            if (!reader.verify(resolveThreadCount(opts.threads))) {
+                errorLog() << "Error: " << reader.error() << "\n";
+                return 1;
+            }
+            markVerified(inputFile, reader.view());
+        }
+        reader.setTrusted(true);
+    }
+
+    std::unique_ptr<NflcBlockCache> cache = openBlockCache(opts);
+    reader.setCache(cache.get());
+
+    std::pair<size_t, size_t> blocks = reader.findBlocks(offset, length);
+    infoLog() << "Extracting " << length << " bytes at offset " << offset << " from " << inputFile << "\n";
+    infoLog() << "Decoding " << (blocks.second - blocks.first) << " of " << reader.blocks().size() << " blocks\n";
+
+    std::vector<unsigned char> data(static_cast<size_t>(length));
+    if (!reader.readRange(offset, static_cast<uint32_t>(length), data.data(), resolveThreadCount(opts.threads))) {
+        errorLog() << "Error: " << reader.error() << "\n";
+        return 1;
+    }
+    reportBlockCache(cache.get());
+
+    std::ofstream ofs;
+    std::ostream* out = openOutput(outputFile, ofs);
+    if (out == nullptr) {
+        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
+        return 1;
+    }
+    {
+        NflcStageTimer timer(NflcStage::OutputWrite);
+        out->write(reinterpret_cast<const char*>(data.data()), data.size());
+        out->flush();
+    }
+    if (!*out) {
+        std::cerr << "Error: Failed writing output\n";
+        return 1;
+    }
+
+    if (outputFile != "-") {
+        infoLog() << "Successfully extracted to: " << outputFile << "\n";
+    }
+    return 0;
+}
+
+// --recover: decompress whatever survives in a damaged archive
+int recoverArchive(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    NflcMappedFile in;
+    if (!in.open(inputFile)) {
+        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+        return 1;
+    }
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    infoLog() << "Recovering " << inputFile << "...\n";
+    std::vector<unsigned char> outputData;
+    NflcRecovery report;
+    if (!nflcRecover(in.view(), outputData, report, resolveThreadCount(opts.threads))) {
+        std::cerr << "Error: " << report.error << "\n";
+        return 1;
+    }
+
+    size_t good = 0;
+    for (const NflcRecoveredBlock& b : report.blocks) {
+        if (b.result == NFLC_OK) {
+            good++;
+            blockLog() << "Block at " << b.fileOffset << ": " << b.uncompSize << " bytes at " << b.uncompOffset << "\n";
+        }
+        else {
+            std::cerr << "Warning: Block at " << b.fileOffset << " (" << b.uncompSize << " bytes at " << b.uncompOffset
+                << ") " << nflcErrorText(b.result) << "\n";
+        }
+    }
+    uint64_t damagedBytes = 0;
+    for (const std::pair<uint64_t, uint64_t>& d : report.damaged) {
+        std::cerr << "Damaged: " << d.second << " bytes at " << d.first << " zero-filled\n";
+        damagedBytes += d.second;
+    }
+
+    if (!writeOutputFile(outputFile, outputData.data(), outputData.size(), opts)) {
+        std::cerr << "Error: Cannot write output file: " << outputFile << "\n";
+        return 1;
+    }
+
+    infoLog() << "\nRecovered " << good << " of " << report.blocks.size() << " blocks (" << report.resynced
+        << " found off the slot grid), " << outputData.size() - damagedBytes << " of " << outputData.size() << " bytes\n";
+    infoLog() << "Wrote " << outputFile << "\n";
+    return report.damaged.empty() ? 0 : 1;
+}
+
+// -t: decode every block and check its checksums without writing any output
+int testArchive(const std::string& inputFile, const Options& opts) {
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    NflcReader reader;
+    if (!reader.open(inputFile)) {
+        std::cerr << "Error: " << inputFile << ": " << reader.error() << "\n";
+        return 1;
+    }
+    nflcProgress().expect(reader.totalUncompSize());
+    if (!reader.verify(resolveThreadCount(opts.threads))) {
+        errorLog() << "Error: " << inputFile << ": " << reader.error() << "\n";
+        return 1;
+    }
+    if (opts.trusted) {
+        markVerified(inputFile, reader.view());
+    }
+
+    size_t withCrc = std::count_if(reader.blocks().begin(), reader.blocks().end(),
+        [](const NflcReader::BlockEntry& e) { return e.crc.present; });
+    infoLog() << inputFile << ": OK, " << reader.blocks().size() << " blocks decoded, "
+        << withCrc << " with CRC-32C checksums\n";
+    return 0;
+}
+
+// Per-block line of the compressors
+void logBlock(uint32_t index, const NflcChunk& ci) {
+    blockLog() << "Block " << index << ": " << ci.uncompSize << " -> " << ci.compSize << " bytes\n";
+}
+
+int compress(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    std::ifstream ifs(inputFile, std::ios::binary);
+    if (!ifs.is_open()) {
+        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+        return 1;
+    }
+
+    // Initialize LZO
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    // Get input file size
+    ifs.seekg(0, std::ios::end);
+    std::streamoff inputSize = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+
+    infoLog() << "Compressing " << inputFile << " (" << inputSize << " bytes)...\n";
+    nflcProgress().expect(static_cast<uint64_t>(inputSize));
+
+    // Read entire input
+    std::vector<unsigned char> inputData(inputSize);
+    {
+        NflcStageTimer timer(NflcStage::IoRead);
+        ifs.read(reinterpret_cast<char*>(inputData.data()), inputSize);
+        ifs.close();
+    }
+
+    // --base: the earlier archive stays mapped until the blocks reused from it are written
+    NflcReader base;
+    if (!opts.base.empty()) {
+        std::error_code ec;
+        if (std::filesystem::equivalent(opts.base, outputFile, ec)) {
+            std::cerr << "Error: Output file must not overwrite the base archive\n";
+            return 1;
+        }
+        if (!base.open(opts.base)) {
+            std::cerr << "Error: " << base.error() << "\n";
+            return 1;
+        }
+    }
+
+    // Prepare output file
+    NflcFileSink sink;
+    if (!sink.open(outputFile, opts.direct)) {
+        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
+        return 1;
+    }
+
+    // First pass: compress all chunks and calculate total compressed size
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    uint32_t totalZSize = 0;
+    uint64_t failOffset = 0;
+    uint64_t reusedBytes = 0;
+    std::vector<NflcWorkerBuffers> buffers = nflcMakeWorkerBuffers(numThreads, true);
+    NflcPayloadArena arena;
+    std::vector<NflcChunk> chunks;
+    int result = opts.base.empty()
+        ? nflcPackBuffer(inputData.data(), inputData.size(), compressOptions(opts), buffers, arena, chunks, totalZSize, failOffset)
+        : nflcPackIncremental(inputData.data(), inputData.size(), base, compressOptions(opts), buffers, arena, chunks,
+            totalZSize, failOffset, reusedBytes);
+    // A cancelled run must not leave a plausible-looking archive behind
+    if (result == NFLC_E_CANCELLED) {
+        sink.discard();
+        return 1;
+    }
+    if (result != NFLC_OK) {
+        std::cerr << "Error: Compression failed at offset " << failOffset << "\n";
+        return 1;
+    }
+    if (!opts.base.empty()) {
+        infoLog() << "Reused " << reusedBytes << " of " << inputSize << " bytes from " << opts.base << "\n";
+    }
+
+    infoLog() << "Compressed into " << chunks.size() << " blocks (" << numThreads << " worker threads)\n";
+    infoLog() << "Total compressed size: " << totalZSize << " bytes\n";
+
+    // Second pass: write blocks, checking each one in the background with --verify
+    std::unique_ptr<NflcBlockVerifier> verifier;
+    if (opts.verify) {
+        verifier = std::make_unique<NflcBlockVerifier>(numThreads);
+        verifier->beginArchive(inputData);
+    }
+    bool written = nflcWriteBlocks(sink, chunks, totalZSize, static_cast<uint32_t>(inputSize), verifier.get());
+    // An archive that failed its round-trip check is not left under the output name
+    if (verifier && !verifier->drain()) {
+        std::cerr << "Error: Verification failed at " << verifier->error() << " (" << outputFile << ")\n";
+        sink.discard();
+        return 1;
+    }
+    if (!written || !sink.close()) {
+        std::cerr << "Error: Failed writing output file: " << outputFile << "\n";
+        return 1;
+    }
+    if (verifier) {
+        infoLog() << "Verified " << verifier->verifiedBlocks() << " blocks\n";
+    }
+    for (size_t i = 0; i < chunks.size(); i++) {
+        logBlock(static_cast<uint32_t>(i), chunks[i]);
+    }
+
+    uint64_t outputSize = sink.size();
+
+    infoLog() << "\nSuccessfully compressed to: " << outputFile << "\n";
+    infoLog() << "Output file size: " << outputSize << " bytes\n";
+    infoLog() << "Compression ratio: " << std::fixed << std::setprecision(1)
+        << (100.0 * outputSize / inputSize) << "%\n";
+
+    return 0;
+}
+
+// Streaming compression: input is read ahead from any stream (stdin included) and fed to
+// an NflcWriter, which packs and writes a batch of regions at a time, so memory stays bounded
+// by the batch size. Headers go out with zero totals that are patched in at the end, which
+// is why the output has to be a seekable file. Region boundaries match compress(), so both
+// produce identical archives.
+
+int compressStream(const std::string& inputFile, const std::string& outputFile, const Options& opts) {
+    bool useStdin = (inputFile == "-");
+    if (outputFile == "-") {
+        std::cerr << "Error: Compressed output must be a seekable file, not stdout\n";
+        return 1;
+    }
+
+    std::ifstream ifs;
+    if (useStdin) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+    else {
+        ifs.open(inputFile, std::ios::binary);
+        if (!ifs.is_open()) {
+            std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+            return 1;
+        }
+    }
+    std::istream& in = useStdin ? std::cin : ifs;
+
+    NflcFileSink sink;
+    if (!sink.open(outputFile, opts.direct)) {
+        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
+        return 1;
+    }
+
+    // Initialize LZO
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    infoLog() << "Compressing " << (useStdin ? "<stdin>" : inputFile) << " (streaming)...\n";
+    if (!useStdin) {
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(inputFile, ec);
+        nflcProgress().expect(ec ? 0 : size);
+    }
+
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    NflcWriter writer(sink, compressOptions(opts), numThreads);
+    writer.onBlock(logBlock);
+    ReadAhead reader(in, opts.ioDepth);
+    std::vector<unsigned char> buffer(IO_CHUNK_BYTES);
+
+    for (;;) {
+        size_t got = reader.read(buffer.data(), buffer.size());
+        if (got < buffer.size() && reader.bad()) {
+            std::cerr << "Error: Failed reading input at offset " << (writer.inputSize() + got) << "\n";
+            return 1;
+        }
+        if (got > 0 && !writer.append(NflcByteSpan(buffer.data(), got))) {
+            errorLog() << "Error: " << writer.error() << " (" << outputFile << ")\n";
+            if (nflcProgress().cancelled() || writer.verifyFailed()) {
+                sink.discard();
+            }
+            return 1;
+        }
+        if (got < buffer.size()) {
+            break;
+        }
+    }
+
+    if (!writer.finish() || !sink.close()) {
+        errorLog() << "Error: " << (writer.error().empty() ? "Failed writing output" : writer.error())
+            << " (" << outputFile << ")\n";
+        if (nflcProgress().cancelled() || writer.verifyFailed()) {
+            sink.discard();
+        }
+        return 1;
+    }
+
+    uint64_t inputSize = writer.inputSize();
+    uint64_t totalZSize = writer.zSize();
+    uint64_t outputSize = writer.bytesWritten();
+    infoLog() << "Compressed into " << writer.blocks() << " blocks (" << numThreads << " worker threads)\n";
+    infoLog() << "Total compressed size: " << totalZSize << " bytes\n";
+    infoLog() << "\nSuccessfully compressed " << inputSize << " bytes to: " << outputFile << "\n";
+    infoLog() << "Output file size: " << outputSize << " bytes\n";
+    if (inputSize > 0) {
+        infoLog() << "Compression ratio: " << std::fixed << std::setprecision(1)
+            << (100.0 * outputSize / inputSize) << "%\n";
+    }
+
+    return 0;
+}
+
+// One input/output pair processed by batch mode
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// Match a file name against a pattern using '*' and '?' wildcards
+bool wildcardMatch(const char* pattern, const char* name) {
+    const char* starPattern = nullptr;
+    const char* starName = nullptr;
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            starPattern = ++pattern;
+            starName = name;
+        }
+        else if (*pattern == '?' || *pattern == *name) {
+            pattern++;
+            name++;
+        }
+        else if (starPattern != nullptr) {
+            pattern = starPattern;
+            name = ++starName;
+        }
+        else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+std::string batchOutputName(const std::filesystem::path& input, const std::string& outDir, bool compressing) {
+    std::filesystem::path name = input.filename();
+    if (compressing) {
+        name += ".nflc";
+    }
+    else if (name.extension() == ".nflc") {
+        name.replace_extension();
+    }
+    else {
+        name += ".bin";
+    }
+    return (std::filesystem::path(outDir) / name).string();
+}
+
+// Expand a batch source into jobs. The source is either a directory (every regular file in
+// it), a wildcard pattern in the last path component (e.g. data/*.nflc), or a manifest file
+// listing one input per line, optionally followed by a tab and an explicit output path.
+bool collectBatchJobs(const std::string& source, const std::string& outDir, bool compressing,
+    std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path sourcePath(source);
+    std::string pattern = sourcePath.filename().string();
+
+    if (pattern.find_first_of("*?") != std::string::npos || fs::is_directory(sourcePath, ec)) {
+        fs::path dir = sourcePath;
+        if (pattern.find_first_of("*?") != std::string::npos) {
+            dir = sourcePath.parent_path();
+            if (dir.empty()) {
+                dir = ".";
+            }
+        }
+        else {
+            pattern = "*";
+        }
+
+        std::vector<fs::path> inputs;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec) && wildcardMatch(pattern.c_str(), it->path().filename().string().c_str())) {
+                inputs.push_back(it->path());
+            }
+        }
+        if (ec) {
+            std::cerr << "Error: Cannot read directory: " << dir.string() << "\n";
+            return false;
+        }
+        std::sort(inputs.begin(), inputs.end());
+        for (const fs::path& in : inputs) {
+            jobs.push_back({ in.string(), batchOutputName(in, outDir, compressing) });
+        }
+        return true;
+    }
+
+    std::ifstream manifest(source);
+    if (!manifest.is_open()) {
+        std::cerr << "Error: Cannot open batch source: " << source << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        BatchJob job;
+        job.input = line.substr(0, tab);
+        job.output = (tab != std::string::npos) ? line.substr(tab + 1)
+            : batchOutputName(job.input, outDir, compressing);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Batch mode: every block (decompress) or region (compress) of every file is queued on one
+// shared worker pool, so small and large files balance across cores within a single process.
+// nflcParallelFor gives each worker its own contiguous run of tasks, so workers start at the
+// heads of their runs, spread across the file list, and move through it in file order. A file
+// is opened by the first worker that reaches one of its tasks and written out by the worker
+// that finishes its last one. The file a worker is in is held, and so is one split across two
+// runs (or by a steal) until both workers finish their parts, so up to about two files per
+// thread are in memory at once.
+int runBatch(const std::string& source, const std::string& outDir, bool compressing, const Options& opts) {
+    std::vector<BatchJob> jobs;
+    if (!collectBatchJobs(source, outDir, compressing, jobs)) {
+        return 1;
+    }
+    if (jobs.empty()) {
+        std::cerr << "Error: No input files found in " << source << "\n";
+        return 1;
+    }
+
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+
+    uint32_t regionSize = nflcRegionSize(compressOptions(opts));
+    uint32_t maxChunk = opts.pack ? std::max<uint32_t>(opts.maxChunk, 1) : NFLC_TARGET_CHUNK;
+
+    struct BatchFile {
+        BatchJob job;
+        uint32_t firstTask = 0;
+        uint32_t numTasks = 0;
+        std::once_flag opened;
+        bool openOk = false;
+        bool trusted = false;                             // decompress: --trusted and already verified
+        NflcMappedFile in;
+        std::vector<unsigned char> outputData;            // decompress
+        std::vector<NflcSlotResult> results;              // decompress
+        std::vector<std::vector<NflcChunk>> regions;      // compress
+        std::vector<int> regionResults;                   // compress
+        NflcPayloadArena arena;                           // compress
+        std::atomic<uint32_t> remaining{ 0 };
+        std::string error;
+    };
+
+    // Size every file's task list up front from the file size alone
+    std::vector<std::unique_ptr<BatchFile>> files;
+    std::vector<uint32_t> taskStarts;
+    uint32_t totalTasks = 0;
+    for (const BatchJob& job : jobs) {
+        auto file = std::make_unique<BatchFile>();
+        file->job = job;
+        uintmax_t size = std::filesystem::file_size(job.input, ec);
+        if (ec) {
+            size = 0;
+        }
+        uint32_t unit = compressing ? regionSize : NFLC_BLOCK_SIZE;
+        file->numTasks = std::max<uint32_t>(static_cast<uint32_t>((size + unit - 1) / unit), 1);
+        file->firstTask = totalTasks;
+        file->remaining = file->numTasks;
+        taskStarts.push_back(totalTasks);
+        totalTasks += file->numTasks;
+        files.push_back(std::move(file));
+    }
+
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    infoLog() << "Batch " << (compressing ? "compressing " : "decompressing ") << files.size()
+        << " files (" << totalTasks << " tasks, " << numThreads << " worker threads)\n";
+
+    std::vector<NflcWorkerBuffers> buffers = nflcMakeWorkerBuffers(numThreads, compressing);
+    std::unique_ptr<NflcBlockCache> cache = compressing ? nullptr : openBlockCache(opts);
+
+    std::mutex logMutex;
+    std::atomic<uint32_t> failures{ 0 };
+
+    auto openFile = [&](BatchFile& f) {
+        if (!f.in.open(f.job.input)) {
+            f.error = "Cannot open input file";
+            return;
+        }
+        if (compressing) {
+            nflcProgress().expect(f.in.size());
+            f.arena.reset(f.in.size(), regionSize, maxChunk);
+            f.regions.resize(f.numTasks);
+            f.regionResults.assign(f.numTasks, NFLC_OK);
+        }
+        else {
+            NflcBlockHeader firstHdr;
+            if (!nflcReadBlockHeader(f.in.view(), 0, firstHdr)) {
+                f.error = "Not an NFLC file";
+                return;
+            }
+            nflcProgress().expect(firstHdr.totalUncompSize);
+            f.outputData.resize(firstHdr.totalUncompSize);
+            f.results.resize(f.numTasks);
+            f.trusted = opts.trusted && isVerified(f.job.input, f.in.view());
+        }
+        f.openOk = true;
+    };
+
+    auto finishFile = [&](BatchFile& f) {
+        size_t outSize = 0;
+        size_t blocks = 0;
+        // Cancelled regions and slots are left unpacked or undecoded; write nothing
+        if (nflcProgress().cancelled()) {
+            f.error = "Cancelled";
+        }
+        if (f.openOk && compressing) {
+            uint32_t totalZSize = 0;
+            std::vector<NflcChunk> chunks;
+            for (uint32_t i = 0; i < f.numTasks && f.error.empty(); i++) {
+                if (f.regionResults[i] != NFLC_OK) {
+                    f.error = "Compression failed at offset " + std::to_string(static_cast<uint64_t>(i) * regionSize);
+                }
+                for (const NflcChunk& ci : f.regions[i]) {
+                    totalZSize += ci.compSize;
+                    chunks.push_back(ci);
+                }
+            }
+            if (f.error.empty()) {
+                // The other workers go on packing later files while this one is checked
+                std::unique_ptr<NflcBlockVerifier> verifier;
+                if (opts.verify) {
+                    verifier = std::make_unique<NflcBlockVerifier>(numThreads);
+                    verifier->beginArchive(f.in.view());
+                }
+                NflcFileSink sink;
+                bool written = sink.open(f.job.output, opts.direct) &&
+                    nflcWriteBlocks(sink, chunks, totalZSize, static_cast<uint32_t>(f.in.size()), verifier.get());
+                if (verifier && !verifier->drain()) {
+                    f.error = "Verification failed at " + verifier->error();
+                    sink.discard();
+                }
+                else if (!written || !sink.close()) {
+                    f.error = "Cannot write output file";
+                }
+                outSize = static_cast<size_t>(sink.size());
+                blocks = chunks.size();
+            }
+        }
+        else if (f.openOk) {
+            for (uint32_t i = 0; i < f.numTasks && f.error.empty(); i++) {
+                const NflcSlotResult& res = f.results[i];
+                if (res.status == NflcSlotStatus::Overflow) {
+                    f.error = "Output buffer overflow at block " + std::to_string(i);
+                }
+                else if (res.status == NflcSlotStatus::Failed) {
+                    f.error = "Block " + std::to_string(i) + " " + nflcErrorText(res.lzoResult);
+                }
+                else if (res.status == NflcSlotStatus::Ok) {
+                    outSize = std::max<size_t>(outSize, res.outOffset + res.outLen);
+                    blocks++;
+                }
+            }
+            if (f.error.empty() && !writeOutputFile(f.job.output, f.outputData.data(), outSize, opts)) {
+                f.error = "Cannot write output file";
+            }
+            if (f.error.empty() && opts.trusted && !f.trusted) {
+                markVerified(f.job.input, f.in.view());
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (f.error.empty()) {
+                blockLog() << f.job.input << " -> " << f.job.output << ": " << blocks << " blocks, "
+                    << outSize << " bytes\n";
+            }
+            else if (!nflcProgress().cancelled()) {
+                std::cerr << "Error: " << f.job.input << ": " << f.error << "\n";
+            }
+        }
+        if (!f.error.empty()) {
+            failures++;
+        }
+
+        // Release the file's buffers as soon as it is done
+        f.in.close();
+        std::vector<unsigned char>().swap(f.outputData);
+        std::vector<NflcSlotResult>().swap(f.results);
+        std::vector<std::vector<NflcChunk>>().swap(f.regions);
+        f.arena = NflcPayloadArena();
+    };
+
+    nflcParallelFor(totalTasks, numThreads, [&](uint32_t task, unsigned worker) {
+        size_t fileIndex = std::upper_bound(taskStarts.begin(), taskStarts.end(), task) - taskStarts.begin() - 1;
+        BatchFile& f = *files[fileIndex];
+        uint32_t local = task - f.firstTask;
+
+        // Once cancelled, the remaining tasks only count down their files
+        bool live = !nflcProgress().cancelled();
+        if (live) {
+            std::call_once(f.opened, openFile, std::ref(f));
+        }
+        if (live && f.openOk) {
+            if (compressing) {
+                size_t offset = static_cast<size_t>(local) * regionSize;
+                if (offset < f.in.size() || (offset == 0 && f.in.size() == 0)) {
+                    uint32_t length = static_cast<uint32_t>(std::min<size_t>(regionSize, f.in.size() - offset));
+                    f.regionResults[local] = nflcPackRegion(f.in.data() + offset, length, maxChunk, opts.level,
+                        buffers[worker], f.arena.stripe(local), f.arena.stripeCapacity(), f.regions[local], opts.split);
+                }
+            }
+            else {
+                nflcDecodeSlot(f.in.view(), local, f.outputData, f.results[local], f.trusted, cache.get());
+            }
+        }
+
+        if (f.remaining.fetch_sub(1) == 1) {
+            finishFile(f);
+        }
+    });
+
+    infoLog() << "\nProcessed " << files.size() - failures << " of " << files.size() << " files\n";
+    reportBlockCache(cache.get());
+    return failures == 0 ? 0 : 1;
+}
+
+// -mc: compress the files of a batch source into one multi-file pack. Members are named
+// after their file, or the second column of a manifest line; --hot patterns mark the members
+// to lay out first.
+int packCompress(const std::string& source, const std::string& outputFile, const Options& opts) {
+    std::vector<BatchJob> jobs;
+    if (!collectBatchJobs(source, "", true, jobs)) {
+        return 1;
+    }
+    if (jobs.empty()) {
+        std::cerr << "Error: No input files found in " << source << "\n";
+        return 1;
+    }
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<NflcMappedFile>> inputs;
+    std::vector<NflcPackInput> members;
+    size_t hotCount = 0;
+    for (const BatchJob& job : jobs) {
+        auto in = std::make_unique<NflcMappedFile>();
+        if (!in->open(job.input)) {
+            std::cerr << "Error: Cannot open input file: " << job.input << "\n";
+            return 1;
+        }
+        NflcPackInput member;
+        bool explicitName = job.output != batchOutputName(job.input, "", true);
+        member.name = explicitName ? job.output : std::filesystem::path(job.input).filename().string();
+        member.data = in->view();
+        for (const std::string& pattern : opts.hot) {
+            member.hot = member.hot || wildcardMatch(pattern.c_str(), member.name.c_str());
+        }
+        hotCount += member.hot;
+        members.push_back(member);
+        inputs.push_back(std::move(in));
+    }
+
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    infoLog() << "Packing " << members.size() << " files (" << hotCount << " hot) into " << outputFile
+        << " on " << numThreads << " worker threads\n";
+
+    NflcFileSink sink;
+    if (!sink.open(outputFile, opts.direct)) {
+        std::cerr << "Error: Cannot create output file: " << outputFile << "\n";
+        return 1;
+    }
+    for (const NflcPackInput& member : members) {
+        nflcProgress().expect(member.data.size());
+    }
+    std::string error;
+    // A pack that was cancelled, failed verification or stopped part way is never left behind
+    if (!nflcWritePack(sink, members, compressOptions(opts), numThreads, error)) {
+        errorLog() << "Error: " << error << "\n";
+        sink.discard();
+        return 1;
+    }
+    if (!sink.close()) {
+        std::cerr << "Error: Failed writing output\n";
+        return 1;
+    }
+    infoLog() << "Pack size: " << sink.size() << " bytes\n";
+    return 0;
+}
+
+// -mx: extract every member of a pack into outDir
+int packExtract(const std::string& inputFile, const std::string& outDir, const Options& opts) {
+    NflcPackReader pack;
+    if (!pack.open(inputFile)) {
+        std::cerr << "Error: " << pack.error() << "\n";
+        return 1;
+    }
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    unsigned numThreads = resolveThreadCount(opts.threads);
+    std::unique_ptr<NflcBlockCache> cache = openBlockCache(opts);
+    std::vector<unsigned char> outputData;
+    size_t failures = 0;
+    for (const NflcPackReader::Member& member : pack.members()) {
+        nflcProgress().expect(member.uncompSize);
+    }
+    for (size_t i = 0; i < pack.members().size() && !nflcProgress().cancelled(); i++) {
+        const NflcPackReader::Member& member = pack.members()[i];
+        // Member names come from the pack; never write outside outDir
+        std::filesystem::path name(member.name);
+        bool safe = !name.empty() && name.is_relative() && !name.has_root_name();
+        for (const std::filesystem::path& part : name) {
+            safe = safe && part != "..";
+        }
+        if (!safe) {
+            std::cerr << "Error: Skipping member with unsafe name: " << member.name << "\n";
+            failures++;
+            continue;
+        }
+
+        outputData.assign(member.uncompSize, 0);
+        NflcReader reader;
+        reader.setCache(cache.get());
+        if (member.size > 0 && (!reader.open(pack.member(i)) ||
+            !reader.readRange(0, member.uncompSize, outputData.data(), numThreads))) {
+            errorLog() << "Error: " << member.name << ": " << reader.error() << "\n";
+            failures++;
+            continue;
+        }
+
+        std::filesystem::path outPath = std::filesystem::path(outDir) / name;
+        std::error_code ec;
+        std::filesystem::create_directories(outPath.parent_path(), ec);
+        if (!writeOutputFile(outPath.string(), outputData.data(), outputData.size(), opts)) {
+            std::cerr << "Error: Cannot write output file: " << outPath.string() << "\n";
+            failures++;
+            continue;
+        }
+        blockLog() << member.name << ": " << member.size << " -> " << member.uncompSize << " bytes\n";
+    }
+
+    infoLog() << "Extracted " << pack.members().size() - failures << " of " << pack.members().size() << " members\n";
+    reportBlockCache(cache.get());
+    return failures == 0 ? 0 : 1;
+}
+
+// Peak resident set size of this process in bytes (0 if unavailable), since the last
+// successful resetPeakMemory() or else since the process started
+size_t peakMemoryBytes() {
+#ifdef __linux__
+    // VmHWM, unlike ru_maxrss, follows resetPeakMemory()
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return static_cast<size_t>(std::strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+        }
+    }
+#endif
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Restart the peak resident set size from the current one. Only Linux can (through
+// /proc/self/clear_refs); elsewhere the peak stays process-wide and this returns false.
+bool resetPeakMemory() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    return static_cast<bool>(clearRefs << "5" << std::flush);
+#else
+    return false;
+#endif
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// Deterministic stand-in for game data: runs of similar fixed-size records (tables, headers),
+// already-compressed noise (audio, textures) and zero fill, in roughly ps2pack proportions
+std::vector<unsigned char> makeBenchCorpus(size_t size, uint32_t seed) {
+    std::vector<unsigned char> data(size);
+    uint32_t state = seed * 2654435761u + 1;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    size_t pos = 0;
+    while (pos < size) {
+        size_t run = std::min<size_t>(size - pos, 4096 + next() % 61440);
+        uint32_t kind = next() % 8;
+        if (kind < 5) {
+            uint32_t record = 16 + next() % 48;
+            for (size_t i = 0; i < run; i++) {
+                data[pos + i] = static_cast<unsigned char>((i % record) * 7 + ((i / record) & 3));
+            }
+        }
+        else if (kind < 7) {
+            for (size_t i = 0; i < run; i++) {
+                data[pos + i] = static_cast<unsigned char>(next());
+            }
+        }
+        else {
+            std::memset(data.data() + pos, 0, run);
+        }
+        pos += run;
+    }
+    return data;
+}
+
+// --bench: in-process compress/decompress round trips over a corpus at several thread counts.
+// Reports throughput on uncompressed bytes, blocks/s, per-task latency percentiles (one task
+// is a packing region when compressing, a slot when decompressing) and peak RSS, then checks
+// a pack of the whole corpus round-trips.
+int runBenchmark(const std::vector<std::string>& corpusFiles, const Options& opts) {
+    if (!nflcInit()) {
+        std::cerr << "Error: LZO initialization failed\n";
+        return 1;
+    }
+
+    struct Sample {
+        std::string name;
+        std::vector<unsigned char> data;
+    };
+    std::vector<Sample> corpus;
+    for (const std::string& file : corpusFiles) {
+        NflcMappedFile in;
+        if (!in.open(file)) {
+            std::cerr << "Error: Cannot open input file: " << file << "\n";
+            return 1;
+        }
+        corpus.push_back({ file, std::vector<unsigned char>(in.data(), in.data() + in.size()) });
+    }
+    if (corpus.empty()) {
+        const size_t sizes[] = { 256 * 1024, 4 * 1024 * 1024, 32 * 1024 * 1024 };
+        for (size_t size : sizes) {
+            corpus.push_back({ "synthetic-" + std::to_string(size / 1024) + "K", makeBenchCorpus(size, static_cast<uint32_t>(size)) });
+        }
+    }
+
+    // Thread counts: powers of two up to 16, then steps of 8 to show where scaling flattens
+    // on many-core and multi-socket machines, up to -j (all cores when -j is not given)
+    unsigned maxThreads = resolveThreadCount(opts.threads == 1 ? 0 : opts.threads);
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < maxThreads; t = t < 16 ? t * 2 : t + 8) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    // Repeat every measurement until it has run for at least this long
+    constexpr double MIN_SECONDS = 0.5;
+    constexpr int MIN_ITERATIONS = 3;
+
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point since) {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    };
+
+    // Each row's peak covers that configuration (plus the corpus) where the peak can be reset;
+    // otherwise the column is the process-wide peak so far, which only grows
+    bool rowPeak = resetPeakMemory();
+    std::cout << "NFLC benchmark" << (opts.pack ? " (--pack)" : "") << (opts.pack && opts.split ? " (--split)" : "")
+        << (nflcWorkerAffinity() ? " (--affinity)" : "") << ", decoder: " << nflcDecoderName() << "\n";
+    std::cout << std::left << std::setw(22) << "input" << std::right
+        << std::setw(8) << "threads" << std::setw(8) << "blocks" << std::setw(8) << "ratio"
+        << std::setw(11) << "comp MB/s" << std::setw(13) << "comp p50/p99"
+        << std::setw(11) << "dec MB/s" << std::setw(11) << "dec blk/s" << std::setw(13) << "dec p50/p99"
+        << std::setw(14) << (rowPeak ? "peak MB" : "proc peak MB") << "\n";
+
+    for (const Sample& sample : corpus) {
+        for (unsigned threads : threadCounts) {
+            if (rowPeak) {
+                resetPeakMemory();
+            }
+            // Compress: pack on the pool, then serialise the container to memory. Worker
+            // buffers and the payload arena are reused across iterations, as in batch mode.
+            std::vector<NflcWorkerBuffers> buffers = nflcMakeWorkerBuffers(threads, true);
+            NflcPayloadArena arena;
+            std::vector<unsigned char> archive;
+            std::vector<double> compLatency;
+            double compSeconds = 0.0;
+            int iterations = 0;
+            size_t numChunks = 0;
+            while (iterations < MIN_ITERATIONS || compSeconds < MIN_SECONDS) {
+                std::vector<NflcChunk> chunks;
+                std::vector<double> taskSeconds;
+                uint32_t totalZSize = 0;
+                uint64_t failOffset = 0;
+                auto start = Clock::now();
+                if (nflcPackBuffer(sample.data.data(), sample.data.size(), compressOptions(opts), buffers, arena, chunks,
+                    totalZSize, failOffset, &taskSeconds) != NFLC_OK) {
+                    std::cerr << "Error: " << sample.name << ": compression failed at offset " << failOffset << "\n";
+                    return 1;
+                }
+                NflcMemorySink sink;
+                nflcWriteBlocks(sink, chunks, totalZSize, static_cast<uint32_t>(sample.data.size()));
+                archive.swap(sink.data());
+                compSeconds += seconds(start);
+                compLatency.insert(compLatency.end(), taskSeconds.begin(), taskSeconds.end());
+                numChunks = chunks.size();
+                iterations++;
+            }
+            double compRate = sample.data.size() * iterations / compSeconds / (1024.0 * 1024.0);
+
+            // Decompress the archive just produced, timing every slot
+            NflcByteSpan view(archive);
+            uint32_t numBlocks = nflcBlockCount(archive.size());
+            std::unique_ptr<unsigned char[]> outputBuffer;
+            std::span<unsigned char> outputData;
+            std::vector<NflcSlotResult> results(numBlocks);
+            std::vector<double> decLatency;
+            std::vector<double> slotSeconds(numBlocks);
+            double decSeconds = 0.0;
+            iterations = 0;
+            while (iterations < MIN_ITERATIONS || decSeconds < MIN_SECONDS) {
+                auto start = Clock::now();
+                NflcBlockHeader firstHdr;
+                if (!nflcReadBlockHeader(view, 0, firstHdr) && !sample.data.empty()) {
+                    std::cerr << "Error: " << sample.name << ": compressed archive is not valid\n";
+                    return 1;
+                }
+                // A fresh, untouched buffer each time, as decompress() uses
+                size_t outputSize = sample.data.empty() ? 0 : firstHdr.totalUncompSize;
+                outputBuffer = std::make_unique_for_overwrite<unsigned char[]>(outputSize);
+                outputData = std::span<unsigned char>(outputBuffer.get(), outputSize);
+                nflcParallelFor(numBlocks, threads, [&](uint32_t blockNum, unsigned) {
+                    auto blockStart = Clock::now();
+                    nflcDecodeSlot(view, blockNum, outputData, results[blockNum], false);
+                    slotSeconds[blockNum] = seconds(blockStart);
+                });
+                nflcZeroUnwritten(outputData, results);
+                decSeconds += seconds(start);
+                decLatency.insert(decLatency.end(), slotSeconds.begin(), slotSeconds.end());
+                iterations++;
+            }
+            double decRate = sample.data.size() * iterations / decSeconds / (1024.0 * 1024.0);
+            double blockRate = static_cast<double>(numBlocks) * iterations / decSeconds;
+
+            if (!std::equal(outputData.begin(), outputData.end(), sample.data.begin(), sample.data.end())) {
+                std::cerr << "Error: " << sample.name << ": round trip mismatch at " << threads << " threads\n";
+                return 1;
+            }
+
+            auto latency = [](const std::vector<double>& v) {
+                std::ostringstream oss;
+                oss << std::fixed << std::setprecision(0) << percentile(v, 0.50) * 1e6 << "/"
+                    << percentile(v, 0.99) * 1e6 << "us";
+                return oss.str();
+            };
+
+            std::cout << std::left << std::setw(22) << sample.name << std::right << std::fixed
+                << std::setw(8) << threads << std::setw(8) << numChunks
+                << std::setw(7) << std::setprecision(1) << (sample.data.empty() ? 0.0 : 100.0 * archive.size() / sample.data.size()) << "%"
+                << std::setw(11) << std::setprecision(1) << compRate << std::setw(13) << latency(compLatency)
+                << std::setw(11) << std::setprecision(1) << decRate << std::setw(11) << std::setprecision(0) << blockRate
+                << std::setw(13) << latency(decLatency)
+                << std::setw(14) << std::setprecision(1) << peakMemoryBytes() / (1024.0 * 1024.0) << "\n";
+        }
+    }
+
+    // The corpus once more as a pack, ending in an empty member, read back member by member
+    std::vector<NflcPackInput> members;
+    for (const Sample& sample : corpus) {
+        members.push_back({ sample.name, NflcByteSpan(sample.data), false });
+    }
+    members.push_back({ "empty", NflcByteSpan(), false });
+    NflcMemorySink packSink;
+    NflcPackReader pack;
+    std::string error;
+    if (!nflcWritePack(packSink, members, compressOptions(opts), maxThreads, error) ||
+        !pack.open(NflcByteSpan(packSink.data())) || pack.members().size() != members.size()) {
+        std::cerr << "Error: pack round trip: " << (!error.empty() ? error : pack.error()) << "\n";
+        return 1;
+    }
+    std::vector<unsigned char> memberData;
+    for (size_t i = 0; i < members.size(); i++) {
+        const NflcPackReader::Member& member = pack.members()[i];
+        memberData.assign(member.uncompSize, 0);
+        NflcReader reader;
+        if (member.name != members[i].name || (member.size > 0 && (!reader.open(pack.member(i)) ||
+            !reader.readRange(0, member.uncompSize, memberData.data(), maxThreads))) ||
+            !std::equal(memberData.begin(), memberData.end(), members[i].data.begin(), members[i].data.end())) {
+            std::cerr << "Error: pack round trip mismatch in member " << members[i].name << "\n";
+            return 1;
+        }
+    }
+    std::cout << "pack round trip: " << members.size() << " members, " << packSink.data().size() << " bytes\n";
+    return 0;
+}
+
+// Dispatch the selected mode; returns the process exit code
+int runMode(const std::string& mode, const std::vector<std::string>& files, const Options& opts, const char* programName) {
+    if (mode == "-d" || mode == "--decompress") {
+        if (files.size() < 2) {
+            std::cerr << "Error: Missing output file\n";
+            printUsage(programName);
+            return 1;
+        }
+        if (opts.recover) {
+            return recoverArchive(files[0], files[1], opts);
+        }
+        if (!opts.range.empty()) {
+            return extractRange(files[0], files[1], opts);
+        }
+        if (opts.stream || files[0] == "-" || files[1] == "-") {
+            return decompressStream(files[0], files[1], opts);
+        }
+        return decompress(files[0], files[1], opts);
+    }
+    else if (mode == "-c" || mode == "--compress") {
+        if (files.size() < 2) {
+            std::cerr << "Error: Missing output file\n";
+            printUsage(programName);
+            return 1;
+        }
+        if (opts.stream || files[0] == "-" || files[1] == "-") {
+            if (!opts.base.empty()) {
+                std::cerr << "Error: --base needs the whole input and cannot be used with streaming\n";
+                return 1;
+            }
+            return compressStream(files[0], files[1], opts);
+        }
+        return compress(files[0], files[1], opts);
+    }
+    else if (mode == "-bd" || mode == "--batch-decompress" || mode == "-bc" || mode == "--batch-compress") {
+        if (files.size() < 2) {
+            std::cerr << "Error: Missing output directory\n";
+            printUsage(programName);
+            return 1;
+        }
+        return runBatch(files[0], files[1], mode == "-bc" || mode == "--batch-compress", opts);
+    }
+    else if (mode == "-mc" || mode == "--multi-compress" || mode == "-mx" || mode == "--multi-extract") {
+        if (files.size() < 2) {
+            std::cerr << "Error: Missing output file\n";
+            printUsage(programName);
+            return 1;
+        }
+        if (mode == "-mc" || mode == "--multi-compress") {
+            return packCompress(files[0], files[1], opts);
+        }
+        return packExtract(files[0], files[1], opts);
+    }
+    else if (mode == "-i" || mode == "--info") {
+        return showInfo(files[0], opts);
+    }
+    else if (mode == "-t" || mode == "--test") {
+        return testArchive(files[0], opts);
+    }
+    else {
+        std::cerr << "Error: Unknown mode '" << mode << "'\n";
+        printUsage(programName);
+        return 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool benchMode = argc >= 2 && (std::string(argv[1]) == "--bench" || std::string(argv[1]) == "-B");
+    if (argc < 3 && !benchMode) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    std::string mode = argv[1];
+
+    // Split the remaining arguments into options and positional file names
+    Options opts;
+    std::vector<std::string> files;
+    auto invalidValue = [&](const char* what, const std::string& text) {
+        std::cerr << "Error: Invalid " << what << " '" << text << "'\n";
+        printUsage(argv[0]);
+        return 1;
+    };
+    uint64_t value = 0;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a thread count\n";
+                return 1;
+            }
+            if (!nflcParseCount(argv[++i], UINT_MAX, value)) {
+                return invalidValue("thread count", argv[i]);
+            }
+            opts.threads = static_cast<unsigned>(value);
+        }
+        else if (arg == "--stream") {
+            opts.stream = true;
+        }
+        else if (arg == "--stats" || arg.compare(0, 8, "--stats=") == 0) {
+            opts.stats = true;
+            opts.statsPath = arg.size() > 8 ? arg.substr(8) : std::string();
+        }
+        else if (arg == "--progress" || arg.compare(0, 11, "--progress=") == 0) {
+            std::string kind = arg.size() > 11 ? arg.substr(11) : "text";
+            if (kind != "text" && kind != "json") {
+                std::cerr << "Error: --progress must be text or json\n";
+                return 1;
+            }
+            opts.progress = true;
+            opts.progressJson = (kind == "json");
+        }
+        else if (arg == "-x" || arg == "--extract") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires offset:length\n";
+                return 1;
+            }
+            opts.range = argv[++i];
+        }
+        else if (arg == "--format" || arg.compare(0, 9, "--format=") == 0) {
+            std::string value = arg.size() > 9 ? arg.substr(9) : std::string();
+            if (value.empty() && i + 1 < argc) {
+                value = argv[++i];
+            }
+            if (value != "text" && value != "json" && value != "csv") {
+                std::cerr << "Error: Invalid format '" << value << "' (expected text, json or csv)\n";
+                return 1;
+            }
+            opts.format = value;
+        }
+        else if (arg == "--hot") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a name pattern\n";
+                return 1;
+            }
+            opts.hot.push_back(argv[++i]);
+        }
+        else if (arg == "--direct") {
+            opts.direct = true;
+        }
+        else if (arg == "--verify") {
+            opts.verify = true;
+        }
+        else if (arg == "--pack") {
+            opts.pack = true;
+        }
+        else if (arg == "--split") {
+            opts.split = true;
+        }
+        else if (arg == "--base") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires an archive\n";
+                return 1;
+            }
+            opts.base = argv[++i];
+        }
+        else if (arg == "--cache") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a directory\n";
+                return 1;
+            }
+            opts.cache = true;
+            opts.cacheDir = argv[++i];
+        }
+        else if (arg == "--cache-mem") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a size in MB\n";
+                return 1;
+            }
+            opts.cache = true;
+            if (!nflcParseCount(argv[++i], std::min<uint64_t>(UINT_MAX, SIZE_MAX / (1024 * 1024)), value)) {
+                return invalidValue("cache size", argv[i]);
+            }
+            opts.cacheMemMB = static_cast<unsigned>(value);
+        }
+        else if (arg == "--io-depth") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a chunk count\n";
+                return 1;
+            }
+            if (!nflcParseCount(argv[++i], UINT_MAX, value)) {
+                return invalidValue("I/O depth", argv[i]);
+            }
+            opts.ioDepth = static_cast<unsigned>(value);
+        }
+        else if (arg == "--affinity") {
+            opts.affinity = true;
+        }
+        else if (arg == "--no-simd") {
+            opts.noSimd = true;
+        }
+        else if (arg == "--trusted") {
+            opts.trusted = true;
+        }
+        else if (arg == "--recover") {
+            opts.recover = true;
+        }
+        else if (arg == "--max-chunk") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a size in bytes\n";
+                return 1;
+            }
+            // pack never fits more than one region into a block
+            if (!nflcParseCount(argv[++i], NFLC_PACK_REGION_SIZE, value) || value == 0) {
+                std::cerr << "Error: Invalid --max-chunk size '" << argv[i] << "' (expected 1 to "
+                    << NFLC_PACK_REGION_SIZE << ")\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+            opts.maxChunk = static_cast<uint32_t>(value);
+        }
+        else if (arg == "--level" || arg.compare(0, 8, "--level=") == 0) {
+            std::string value = arg.size() > 8 ? arg.substr(8) : std::string();
+            if (value.empty()) {
+                if (i + 1 >= argc) {
+                    std::cerr << "Error: " << arg << " requires a level (1-9 or auto)\n";
+                    return 1;
+                }
+                value = argv[++i];
+            }
+            if (value == "auto") {
+                opts.level = NFLC_LEVEL_AUTO;
+            }
+            else if (value.size() == 1 && value[0] >= '1' && value[0] <= '9') {
+                opts.level = value[0] - '0';
+            }
+            else {
+                std::cerr << "Error: Invalid compression level '" << value << "' (expected 1-9 or auto)\n";
+                return 1;
+            }
+        }
+        else if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9') {
+            opts.level = arg[1] - '0';
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0 && std::isdigit(static_cast<unsigned char>(arg[2]))) {
+            if (!nflcParseCount(arg.substr(2), UINT_MAX, value)) {
+                return invalidValue("thread count", arg.substr(2));
+            }
+            opts.threads = static_cast<unsigned>(value);
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+    nflcUseReferenceDecoder(opts.noSimd);
+    nflcSetWorkerAffinity(opts.affinity);
+
+    if (benchMode) {
+        return runBenchmark(files, opts);
+    }
+
+    if (files.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // When stdout carries data, informational output moves to stderr. --stats and --progress
+    // silence the per-block lines, --stats the summaries too unless the JSON document goes
+    // to a file.
+    bool stdoutData = files.size() >= 2 && files[1] == "-" && (mode == "-d" || mode == "--decompress");
+    if (stdoutData) {
+        g_infoLog = &std::cerr;
+        g_blockLog = &std::cerr;
+    }
+    if (opts.stats) {
+        nflcStats().enabled = true;
+        g_blockLog = &g_nullLog;
+        if (opts.statsPath.empty()) {
+            g_infoLog = &g_nullLog;
+        }
+    }
+    std::unique_ptr<ProgressReporter> progress;
+    if (opts.progress) {
+        g_blockLog = &g_nullLog;
+        progress = std::make_unique<ProgressReporter>(opts.progressJson);
+    }
+    std::signal(SIGINT, handleInterrupt);
+    std::signal(SIGTERM, handleInterrupt);
+
+    auto start = std::chrono::steady_clock::now();
+    int exitCode = runMode(mode, files, opts, argv[0]);
+    bool cancelled = nflcProgress().cancelled();
+    if (cancelled) {
+        exitCode = 130;
+    }
+    if (progress) {
+        progress->finish(exitCode);
+    }
+    if (cancelled) {
+        std::cerr << "Error: Cancelled\n";
+    }
+
+    if (opts.stats) {
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::ofstream statsFile;
+        std::ostream* statsOut = stdoutData ? &std::cerr : &std::cout;
+        if (!opts.statsPath.empty()) {
+            statsFile.open(opts.statsPath);
+            if (!statsFile.is_open()) {
+                std::cerr << "Error: Cannot create stats file: " << opts.statsPath << "\n";
+                return 1;
+            }
+            statsOut = &statsFile;
+        }
+        writeStatsJson(*statsOut, mode, files, resolveThreadCount(opts.threads), exitCode, wallSeconds);
+    }
+    return exitCode;
+}